@@ -88,6 +88,7 @@ void dbithread::run(void)
             private_locking.lock();
             cp->enlist(&freelist);
             private_locking.release();
+            overload::backlog(-1);
             cp = next;
         }
         if(fp)
@@ -102,9 +103,11 @@ void dbi::post(dbi *rec)
     if(runlast)
         runlast->Next = rec;
     else
-        runlist = runlast = rec;
+        runlist = rec;
+    runlast = rec;
     if(rec->type == STOP)
         cdr = true;
+    overload::backlog(1);
     run.signal();
     run.unlock();
 }
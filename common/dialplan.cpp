@@ -0,0 +1,293 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+
+namespace bayonne {
+
+#define DIAL_SYMBOLS    13      // 0-9, *, #, +
+#define DIAL_DIGITS     18      // longest range we expand
+
+// the trie is first built unpacked in scratch memory...
+typedef struct {
+    uint32_t child[DIAL_SYMBOLS];
+    int32_t route;
+} build_t;
+
+typedef struct {
+    build_t *nodes;
+    unsigned count, alloc;
+    unsigned duplicates;
+} builder_t;
+
+static int symbol(char code)
+{
+    if(code >= '0' && code <= '9')
+        return code - '0';
+
+    switch(code) {
+    case '*':
+        return 10;
+    case '#':
+        return 11;
+    case '+':
+        return 12;
+    default:
+        return -1;
+    }
+}
+
+static bool grow(builder_t *tree)
+{
+    build_t *nodes;
+    unsigned alloc = tree->alloc * 2;
+
+    if(!alloc)
+        alloc = 1024;
+
+    nodes = (build_t *)realloc(tree->nodes, sizeof(build_t) * alloc);
+    if(!nodes)
+        return false;
+
+    tree->nodes = nodes;
+    tree->alloc = alloc;
+    return true;
+}
+
+static bool insert(builder_t *tree, const char *prefix, size_t len, int32_t route)
+{
+    unsigned node = 0, next;
+    int code;
+
+    while(len--) {
+        code = symbol(*(prefix++));
+        if(code < 0)
+            return false;
+
+        next = tree->nodes[node].child[code];
+        if(!next) {
+            if(tree->count >= tree->alloc && !grow(tree))
+                return false;
+            next = tree->count++;
+            memset(&tree->nodes[next], 0, sizeof(build_t));
+            tree->nodes[next].route = -1;
+            tree->nodes[node].child[code] = next;
+        }
+        node = next;
+    }
+
+    // first entry for a prefix wins...
+    if(tree->nodes[node].route > -1)
+        ++tree->duplicates;
+    else
+        tree->nodes[node].route = route;
+    return true;
+}
+
+// covers a range of equal length numbers with the fewest prefixes, so
+// 5551000-5551999 is the single prefix 5551...
+static bool expand(builder_t *tree, const char *first, const char *last, int32_t route)
+{
+    char digits[DIAL_DIGITS + 1];
+    size_t len = strlen(first);
+    uint64_t low, high, step, limit;
+    size_t span;
+
+    if(!len || len > DIAL_DIGITS || len != strlen(last))
+        return false;
+
+    if(strspn(first, "0123456789") != len || strspn(last, "0123456789") != len)
+        return false;
+
+    low = strtoull(first, NULL, 10);
+    high = strtoull(last, NULL, 10);
+    if(low > high)
+        return false;
+
+    while(low <= high) {
+        step = 1;
+        span = 0;
+        while(span < len) {
+            limit = step * 10;
+            if(low % limit || low + limit - 1 > high)
+                break;
+            step = limit;
+            ++span;
+        }
+
+        snprintf(digits, sizeof(digits), "%0*llu", (int)len, (unsigned long long)low);
+        if(!insert(tree, digits, len - span, route))
+            return false;
+
+        if(high - low < step)
+            break;
+        low += step;
+    }
+    return true;
+}
+
+dialplan::dialplan()
+{
+    nodes = NULL;
+    routes = NULL;
+    node_count = route_count = 0;
+}
+
+dialplan *dialplan::create(memalloc *arena, const char *path)
+{
+    char buffer[512];
+    char *cp, *pattern, *script, *params, *last;
+    unsigned lines = 0, count = 0, alloc = 0, pos, next, code;
+    unsigned *order = NULL;
+    route_t *list = NULL, *entries;
+    builder_t tree;
+    dialplan *plan = NULL;
+    caddr_t mp;
+    bool valid;
+
+    FILE *fp = fopen(path, "r");
+    if(!fp)
+        return NULL;
+
+    memset(&tree, 0, sizeof(tree));
+    if(!grow(&tree)) {
+        fclose(fp);
+        return NULL;
+    }
+
+    memset(&tree.nodes[0], 0, sizeof(build_t));
+    tree.nodes[0].route = -1;
+    tree.count = 1;
+
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        ++lines;
+        cp = strchr(buffer, ';');
+        if(cp)
+            *cp = 0;
+
+        pattern = strtok_r(buffer, " \t\r\n", &cp);
+        if(!pattern)
+            continue;
+
+        script = strtok_r(NULL, " \t\r\n", &cp);
+        if(!script) {
+            shell::log(shell::ERR, "%s:%u: no script for %s", path, lines, pattern);
+            continue;
+        }
+
+        params = NULL;
+        if(cp) {
+            cp = String::strip(cp, " \t\r\n");
+            if(cp && *cp)
+                params = cp;
+        }
+
+        if(count >= alloc) {
+            alloc = alloc ? alloc * 2 : 256;
+            entries = (route_t *)realloc(list, sizeof(route_t) * alloc);
+            if(!entries)
+                break;
+            list = entries;
+        }
+
+        last = strchr(pattern, '-');
+        if(last) {
+            *(last++) = 0;
+            valid = expand(&tree, pattern, last, count);
+        }
+        else
+            valid = insert(&tree, pattern, strlen(pattern), count);
+
+        if(!valid) {
+            shell::log(shell::ERR, "%s:%u: invalid dialplan entry", path, lines);
+            continue;
+        }
+
+        list[count].script = arena->dup(script);
+        list[count].params = NULL;
+        if(params)
+            list[count].params = arena->dup(params);
+        ++count;
+    }
+
+    fclose(fp);
+
+    if(tree.duplicates)
+        shell::log(shell::WARN, "%s: %u duplicate prefixes ignored", path, tree.duplicates);
+
+    if(count)
+        order = (unsigned *)malloc(sizeof(unsigned) * tree.count);
+
+    // pack in breadth first order, so children of each node are adjacent
+    // and found by counting lower bits of the map...
+    if(order) {
+        mp = (caddr_t)arena->alloc(sizeof(dialplan));
+        plan = new(mp) dialplan();
+        plan->nodes = (node_t *)arena->alloc(sizeof(node_t) * tree.count);
+        plan->routes = (route_t *)arena->alloc(sizeof(route_t) * count);
+        plan->node_count = tree.count;
+        plan->route_count = count;
+        memcpy(plan->routes, list, sizeof(route_t) * count);
+
+        order[0] = 0;
+        next = 1;
+        for(pos = 0; pos < tree.count; ++pos) {
+            build_t *bp = &tree.nodes[order[pos]];
+            node_t *np = &plan->nodes[pos];
+
+            np->map = 0;
+            np->route = bp->route;
+            np->first = next;
+            for(code = 0; code < DIAL_SYMBOLS; ++code) {
+                if(!bp->child[code])
+                    continue;
+                np->map |= (1 << code);
+                order[next++] = bp->child[code];
+            }
+        }
+        free(order);
+
+        shell::debug(2, "dialplan %s compiled; routes=%u, nodes=%u",
+            path, count, tree.count);
+    }
+
+    free(list);
+    free(tree.nodes);
+    return plan;
+}
+
+const dialplan::route_t *dialplan::find(const char *dialed) const
+{
+    const node_t *np = nodes;
+    int32_t route = np->route;
+    int code;
+
+    while(dialed && *dialed) {
+        code = symbol(*(dialed++));
+        if(code < 0 || !(np->map & (1 << code)))
+            break;
+
+        np = &nodes[np->first + __builtin_popcount(np->map & ((1 << code) - 1))];
+        if(np->route > -1)
+            route = np->route;
+    }
+
+    if(route < 0)
+        return NULL;
+
+    return &routes[route];
+}
+
+} // end namespace
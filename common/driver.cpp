@@ -17,6 +17,78 @@
 
 namespace bayonne {
 
+typedef struct
+{
+    char *name;                             // file name without .bcs
+    time_t modified;
+    off_t size;
+    Script *img;                            // compiled or reused image
+    Script *def;                            // definitions compiled against
+    bool reused;
+} job_t;
+
+typedef struct
+{
+    const char *definitions, *scripts;      // directories compiled
+    job_t *defs, *jobs;                     // sorted by file name
+    unsigned defcount, count;
+    unsigned *pending;                      // jobs that need compiling
+    unsigned compiles;
+    volatile unsigned next;                 // next pending job to claim
+} batch_t;
+
+typedef struct request
+{
+    struct request *next;
+    char name[64];                          // service to recompile
+} request_t;
+
+static class __LOCAL replacer : public DetachedThread, public Conditional
+{
+public:
+    replacer();
+
+    void post(const char *name);
+
+private:
+    request_t *pending, *last;
+    bool running;
+
+    void exit(void);
+    void run(void);
+} recompiler;
+
+class __LOCAL compiler : public JoinableThread
+{
+public:
+    compiler(batch_t *work, Script *def);
+
+private:
+    batch_t *batch;
+    object_pointer<Script> definitions;
+
+    void run(void);
+};
+
+#define DRIVER_PINS 16
+
+// reader pins are counted by the parity of the epoch they entered in, and
+// spread over padded slots so readers on different threads do not share
+// a cache line...
+static struct
+{
+    volatile long count[2];
+    char pad[64 - 2 * sizeof(long)];
+} pins[DRIVER_PINS];
+
+static volatile unsigned epoch = 0;
+static Driver *retired = NULL;
+static Mutex reclaiming;
+static Mutex reloading;
+static volatile unsigned long arena = 0;
+static volatile unsigned long generations = 0;
+static volatile unsigned long serials = 0;
+
 static LinkedObject *callbacks = NULL;
 
 LinkedObject *Driver::registrations = NULL;
@@ -31,7 +103,6 @@ unsigned Driver::ts_alloc = 0;
 unsigned Driver::ts_count = 0;
 OrderedIndex Driver::idle;
 Driver *Driver::active = NULL;
-condlock_t Driver::locking;
 timeout_t Driver::stepping = 50;
 statmap *Driver::stats = NULL;
 const char *Driver::encoding = "generic";
@@ -72,24 +143,260 @@ Driver::image::image(Script *img, LinkedObject **root, const char *name) :
 LinkedObject(root)
 {
     id = name;
+    path = NULL;
+    modified = 0;
+    size = 0;
+    indexed = NULL;
+    incoming = outgoing = false;
     ptr = img;
 }
 
+static int compare(const void *p1, const void *p2)
+{
+    return strcmp(((const job_t *)p1)->name, ((const job_t *)p2)->name);
+}
+
+// list .bcs files of a directory in sorted order so compiles are the
+// same on every reload; names are kept in the driver's own memory...
+static job_t *scan(memalloc *pager, const char *path, unsigned *count)
+{
+    char filename[256];
+    job_t *list = NULL;
+    unsigned limit = 0;
+    struct stat ino;
+    size_t len;
+    dir_t dir;
+
+    *count = 0;
+    dir.open(path);
+    if(!is(dir))
+        return NULL;
+
+    len = snprintf(filename, sizeof(filename), "%s/", path);
+    while(is(dir) && dir.read(filename + len, sizeof(filename) - len) > 0) {
+        char *ep = strrchr(filename + len, '.');
+        if(!ep || !eq(ep, ".bcs"))
+            continue;
+        if(*count + 1 >= limit) {
+            limit += 32;
+            list = (job_t *)realloc(list, sizeof(job_t) * limit);
+        }
+        memset(&list[*count], 0, sizeof(job_t));
+        if(!stat(filename, &ino)) {
+            list[*count].modified = ino.st_mtime;
+            list[*count].size = ino.st_size;
+        }
+        *ep = 0;
+        list[(*count)++].name = pager->dup(filename + len);
+    }
+    dir.close();
+
+    if(!list)
+        list = (job_t *)malloc(sizeof(job_t));
+
+    qsort(list, *count, sizeof(job_t), &compare);
+    return list;
+}
+
+// a change to any definition changes every compiled service...
+static unsigned long signature(const job_t *list, unsigned count)
+{
+    unsigned long sig = 2166136261ul;
+
+    for(unsigned pos = 0; pos < count; ++pos) {
+        for(const char *cp = list[pos].name; *cp; ++cp)
+            sig = (sig ^ (unsigned char)*cp) * 16777619ul;
+        sig = (sig ^ (unsigned long)list[pos].modified) * 16777619ul;
+        sig = (sig ^ (unsigned long)list[pos].size) * 16777619ul;
+    }
+    return sig;
+}
+
+static void compile(batch_t *batch, Script *def)
+{
+    char path[256];
+    unsigned pos;
+    job_t *job;
+
+    while((pos = __sync_fetch_and_add(&batch->next, 1)) < batch->compiles) {
+        job = &batch->jobs[batch->pending[pos]];
+        snprintf(path, sizeof(path), "%s/%s.bcs", batch->scripts, job->name);
+        job->img = Script::compile(NULL, path, def);
+        job->def = def;
+    }
+}
+
+compiler::compiler(batch_t *work, Script *def) :
+JoinableThread()
+{
+    batch = work;
+    definitions = def;
+}
+
+void compiler::run(void)
+{
+    char path[256];
+    Script *def = NULL;
+
+    if(!definitions) {
+        for(unsigned pos = 0; pos < batch->defcount; ++pos) {
+            snprintf(path, sizeof(path), "%s/%s.bcs", batch->definitions, batch->defs[pos].name);
+            def = Script::compile(def, path, NULL);
+        }
+        definitions = def;
+    }
+    compile(batch, *definitions);
+}
+
+replacer::replacer() : DetachedThread(), Conditional()
+{
+    pending = last = NULL;
+    running = false;
+}
+
+void replacer::exit(void)
+{
+}
+
+void replacer::post(const char *name)
+{
+    request_t *req;
+
+    Conditional::lock();
+
+    // a service already waiting will be compiled from the newest file...
+    for(req = pending; req; req = req->next) {
+        if(eq(req->name, name)) {
+            Conditional::unlock();
+            return;
+        }
+    }
+
+    req = (request_t *)malloc(sizeof(request_t));
+    req->next = NULL;
+    String::set(req->name, sizeof(req->name), name);
+    if(last)
+        last->next = req;
+    else
+        pending = req;
+    last = req;
+    if(!running) {
+        running = true;
+        start();
+    }
+    Conditional::signal();
+    Conditional::unlock();
+}
+
+void replacer::run(void)
+{
+    request_t *req;
+
+    shell::log(shell::DEBUG0, "starting script recompiler");
+
+    for(;;) {
+        Conditional::lock();
+        if(!pending)
+            Conditional::wait();
+        req = pending;
+        if(req) {
+            pending = req->next;
+            if(!pending)
+                last = NULL;
+        }
+        Conditional::unlock();
+
+        if(req) {
+            Driver::replace(req->name);
+            free(req);
+        }
+    }
+}
+
 Driver::Driver(const char *dname) :
-keyfile()
+keyfile(), retiring(NULL), serial(0), memused(0)
 {
     Script *img = NULL, *def = NULL;
     char dirpath[256];
-    size_t len;
-    dir_t dir;
+    unsigned pos, threads = 0;
+    batch_t batch;
+    compiler **workers = NULL;
+    keydata *keys;
+    linked_pointer<keydata::keyvalue> kv;
     const char *cp = env("config");
     const char *dpath = env("configs");
 
+    // a reload holds the active driver locked while we are created, and
+    // unchanged images are carried over from it...
+    Driver *prior = active;
+
+    __sync_fetch_and_add(&generations, 1);
+    serial = __sync_add_and_fetch(&serials, 1);
+
     shell::debug(2, "reloading config from %s", cp);
     load(cp);
 
     server::load();
 
+    // parse typed settings once, so later readers never walk keys...
+    memset(&settings, 0, sizeof(settings));
+    // defaults are constant rather than taken from the script engine, so
+    // a key removed from the config reverts on reload...
+    settings.voice = "english/female";
+    settings.stacking = 20;
+    settings.decimals = 2;
+    settings.stepping = 10;
+    settings.symbols = 64;
+    settings.indexing = 177;
+    settings.paging = 1024;
+
+    keys = keyfile::get("defaults");
+    if(keys) {
+        cp = keys->get("voice");
+        if(cp && *cp)
+            settings.voice = cp;
+        cp = keys->get("cps");
+        if(cp)
+            settings.cps = atoi(cp);
+        cp = keys->get("burst");
+        if(cp)
+            settings.burst = atoi(cp);
+    }
+
+    keys = keyfile::get("script");
+    if(keys)
+        kv = keys->begin();
+
+    while(is(kv)) {
+        if(eq(kv->id, "stacking"))
+            settings.stacking = atoi(kv->value);
+        else if(eq(kv->id, "decimals"))
+            settings.decimals = atoi(kv->value);
+        else if(eq(kv->id, "stepping"))
+            settings.stepping = atoi(kv->value);
+        else if(eq(kv->id, "paging"))
+            settings.paging = atol(kv->value);
+        else if(eq(kv->id, "symbols"))
+            settings.symbols = atoi(kv->value);
+        else if(eq(kv->id, "indexing"))
+            settings.indexing = atoi(kv->value);
+        else if(eq(kv->id, "tracking"))
+            settings.tracking = atoi(kv->value);
+        else if(eq(kv->id, "compilers"))
+            settings.compilers = atoi(kv->value);
+        else if(eq(kv->id, "watching"))
+            settings.watching = atoi(kv->value);
+        else if(eq(kv->id, "dialplan") && *kv->value)
+            settings.routing = kv->value;
+        kv.next();
+    }
+
+    if(!settings.routing) {
+        snprintf(dirpath, sizeof(dirpath), "%s/dialplan" CONFIG_EXTENSION, dpath);
+        if(fsys::is_file(dirpath))
+            settings.routing = dup(dirpath);
+    }
+
     snprintf(dirpath, sizeof(dirpath), "%s/%s" CONFIG_EXTENSION, dpath, dname);
     if(fsys::is_file(dirpath)) {
         shell::debug(2, "reloading registrations from %s", dirpath);
@@ -97,68 +404,156 @@ keyfile()
     }
 
     image_services = NULL;
+    image_index = NULL;
+    image_indexing = 0;
+    image_signature = 0;
     activations = NULL;
+    routes = NULL;
+
+    // the dialplan is part of this generation, so a reload swaps it with
+    // everything else when committed...
+    if(settings.routing) {
+        routes = dialplan::create(this, settings.routing);
+        if(!routes)
+            shell::log(shell::ERR, "cannot load dialplan from %s", settings.routing);
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    batch.definitions = env("definitions");
+    batch.scripts = env("scripts");
 
-    String::set(dirpath, sizeof(dirpath), env("definitions"));
-    dir.open(dirpath);
-    if(!is(dir)) {
-        shell::log(shell::ERR, "cannot compile definitions from %s", dirpath);
-        goto noscr;
+    batch.defs = scan(this, batch.definitions, &batch.defcount);
+    if(!batch.defs) {
+        shell::log(shell::ERR, "cannot compile definitions from %s", batch.definitions);
+        if(prior && prior->image_signature)
+            prior = NULL;
     }
+    else {
+        image_signature = signature(batch.defs, batch.defcount);
+        if(prior && prior->image_signature == image_signature && prior->image_definitions) {
+            shell::debug(2, "reusing definitions from %s", batch.definitions);
+            def = *(prior->image_definitions);
+        }
+        else {
+            shell::debug(2, "compiling definitions from %s", batch.definitions);
+            prior = NULL;
+        }
+        for(pos = 0; !def && pos < batch.defcount; ++pos) {
+            shell::log(shell::INFO, "compiling %s.bcs", batch.defs[pos].name);
+            snprintf(dirpath, sizeof(dirpath), "%s/%s.bcs", batch.definitions, batch.defs[pos].name);
+            img = Script::compile(img, dirpath, NULL);
+        }
+        if(!def)
+            def = img;
+    }
+
+    image_definitions = def;
 
-    len = strlen(dirpath);
-    shell::debug(2, "compiling definitions from %s", dirpath);
-    dirpath[len++] = '/';
+    batch.jobs = scan(this, batch.scripts, &batch.count);
+    if(!batch.jobs) {
+        shell::log(shell::ERR, "cannot compile from %s", batch.scripts);
+        goto done;
+    }
 
-    while(is(dir) && dir.read(dirpath + len, sizeof(dirpath) - len) > 0) {
-        char *ep = strrchr(dirpath + len, '.');
-        if(!ep)
-            continue;
-        if(!eq(ep, ".bcs"))
-            continue;
-        shell::log(shell::INFO, "compiling %s", dirpath + len);
-        def = Script::compile(def, dirpath, NULL);
+    shell::debug(2, "compiling services from %s", batch.scripts);
+    batch.pending = (unsigned *)zalloc(sizeof(unsigned) * (batch.count + 1));
+
+    for(pos = 0; pos < batch.count; ++pos) {
+        image *entry = NULL;
+        if(prior)
+            entry = prior->find(batch.jobs[pos].name);
+        if(entry) {
+            // a hot replace may be swapping this image...
+            Mutex::protect(entry);
+            if(entry->modified == batch.jobs[pos].modified && entry->size == batch.jobs[pos].size) {
+                batch.jobs[pos].img = *(entry->ptr);
+                batch.jobs[pos].img->retain();
+                batch.jobs[pos].def = *(entry->defs);
+                batch.jobs[pos].reused = true;
+            }
+            Mutex::release(entry);
+        }
+        if(!batch.jobs[pos].reused)
+            batch.pending[batch.compiles++] = pos;
     }
-    dir.close();
 
-noscr:
-    String::set(dirpath, sizeof(dirpath), env("scripts"));
-    dir.open(dirpath);
-    if(!is(dir)) {
-        shell::log(shell::ERR, "cannot compile from %s", dirpath);
-        return;
+    threads = settings.compilers;
+#ifdef  _SC_NPROCESSORS_ONLN
+    if(!threads)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if(threads > batch.compiles)
+        threads = batch.compiles;
+
+    // the first compiler thread shares our definitions, the others each
+    // compile a private copy so no image is shared between threads; the
+    // workers hold their copies until the images using them are listed...
+    if(threads > 1) {
+        workers = new compiler*[threads];
+        for(pos = 0; pos < threads; ++pos) {
+            workers[pos] = new compiler(&batch, pos ? NULL : def);
+            workers[pos]->start();
+        }
+        for(pos = 0; pos < threads; ++pos)
+            workers[pos]->join();
     }
+    else if(batch.compiles)
+        compile(&batch, def);
 
-    len = strlen(dirpath);
-    shell::debug(2, "compiling services from %s", dirpath);
-    dirpath[len++] = '/';
+    shell::debug(2, "compiled %u of %u services", batch.compiles, batch.count);
 
-    image_definitions = def;
+    image_indexing = batch.count | 1;
+    image_index = (image **)zalloc(sizeof(image *) * image_indexing);
 
-    while(is(dir) && dir.read(dirpath + len, sizeof(dirpath) - len) > 0) {
-        char *ep = strrchr(dirpath + len, '.');
+    // errors and the image chain are done in file order once all are built
+    for(pos = 0; pos < batch.count; ++pos) {
+        job_t *job = &batch.jobs[pos];
+        image *entry;
         void *mp;
-        if(!ep)
-            continue;
-        if(!eq(ep, ".bcs"))
-            continue;
-        shell::log(shell::INFO, "compiling %s", dirpath + len);
-        img = Script::compile(NULL, dirpath, *image_definitions);
-        if(!img) {
-            shell::log(shell::ERR, "%s: failed", dirpath + len);
-            continue;
-        }
 
-        if(errors(img)) {
-            delete img;
-            continue;
+        img = job->img;
+        if(!job->reused) {
+            shell::log(shell::INFO, "compiling %s.bcs", job->name);
+            if(!img) {
+                shell::log(shell::ERR, "%s/%s.bcs: failed", batch.scripts, job->name);
+                continue;
+            }
+
+            if(errors(img)) {
+                delete img;
+                continue;
+            }
         }
 
-        *(ep++) = 0;
         mp = zalloc(sizeof(image));
-        new(mp) image(img, &image_services, dup(dirpath + len));
+        entry = new(mp) image(img, &image_services, job->name);
+        entry->modified = job->modified;
+        entry->size = job->size;
+
+        // each image keeps the definitions it was compiled against, so
+        // only those still in use are carried into later reloads...
+        entry->defs = job->def;
+
+        // entry points are resolved once here rather than per call...
+        entry->incoming = (Script::find(img, "@incoming") != NULL);
+        entry->outgoing = (Script::find(img, "@outgoing") != NULL);
+        index(entry);
+
+        // reused images were retained while taken from the prior driver
+        if(job->reused)
+            img->release();
     }
-    dir.close();
+
+done:
+    if(workers) {
+        for(pos = 0; pos < threads; ++pos)
+            delete workers[pos];
+        delete[] workers;
+    }
+    if(batch.defs)
+        free(batch.defs);
+    if(batch.jobs)
+        free(batch.jobs);
 }
 
 Driver::~Driver()
@@ -168,6 +563,7 @@ Driver::~Driver()
     img = image_services;
     while(is(img)) {
         img->ptr = NULL;
+        img->defs = NULL;
         img.next();
     }
     image_definitions = NULL;
@@ -177,6 +573,21 @@ Driver::~Driver()
         rp->release();
         rp.next();
     }
+
+    // our arena and registry keys are purged with us...
+    __sync_fetch_and_sub(&arena, (unsigned long)memused);
+    __sync_fetch_and_sub(&generations, 1);
+}
+
+void *Driver::_alloc(size_t size)
+{
+    void *mem = keyfile::_alloc(size);
+
+    if(mem) {
+        memused += size;
+        __sync_fetch_and_add(&arena, (unsigned long)size);
+    }
+    return mem;
 }
 
 unsigned Driver::errors(Script *image)
@@ -215,47 +626,120 @@ Span *Driver::getSpan(unsigned span)
     return reinterpret_cast<Span *>(&spans[span_alloc * span]);
 }
 
+static volatile unsigned pinning = 0;
+static __thread unsigned pinned = 0;    // slot + 1, 0 until assigned
+
+// each thread is given its slot once, round robin, so a pin and its
+// release always count in the same slot...
+static unsigned pinslot(void)
+{
+    if(!pinned)
+        pinned = (__sync_fetch_and_add(&pinning, 1) % DRIVER_PINS) + 1;
+
+    return pinned - 1;
+}
+
 Driver *Driver::get(void)
 {
+    unsigned slot = pinslot();
+    unsigned parity;
     Driver *driver;
-    locking.access();
-    driver = active;
-    if(!driver)
-        locking.release();
-    return driver;
+
+    // if a commit swapped in a new driver but has not yet flipped the
+    // epoch, the parities differ and we briefly retry...
+    for(;;) {
+        parity = epoch & 1;
+        __sync_fetch_and_add(&pins[slot].count[parity], 1);
+        driver = active;
+        if(driver && driver->parity == parity)
+            return driver;
+        __sync_fetch_and_sub(&pins[slot].count[parity], 1);
+        if(!driver)
+            return NULL;
+        Thread::yield();
+    }
 }
 
 void Driver::reload(void)
 {
-    locking.access();
-    Driver *driver = active->create();
-    locking.release();
+    Driver *prior;
+    Driver *driver;
+
+    // reloads may come from dispatch or the file watcher...
+    reloading.lock();
+    prior = get();
+    if(!prior) {
+        reloading.unlock();
+        return;
+    }
+
+    driver = prior->create();
+    __sync_fetch_and_sub(&pins[pinslot()].count[prior->parity], 1);
     commit(driver);
+    reloading.unlock();
+}
+
+bool Driver::reclaim(void)
+{
+    statmap *sys;
+    Driver *orig, *next, **prev;
+    Driver *freed = NULL;
+    long count[2] = {0, 0};
+    bool waiting;
+
+    // a generation is free once no reader is pinned with its parity; when
+    // several are waiting this may keep one longer than it must, but it
+    // is never freed while a reader may still be using it...
+    reclaiming.lock();
+    for(unsigned slot = 0; slot < DRIVER_PINS; ++slot) {
+        count[0] += pins[slot].count[0];
+        count[1] += pins[slot].count[1];
+    }
+    prev = &retired;
+    while(*prev) {
+        orig = *prev;
+        if(count[orig->parity]) {
+            prev = &orig->retiring;
+            continue;
+        }
+        *prev = orig->retiring;
+        orig->retiring = freed;
+        freed = orig;
+    }
+    waiting = (retired != NULL);
+    reclaiming.unlock();
+
+    while(freed) {
+        next = freed->retiring;
+        shell::debug(2, "reclaiming prior driver");
+        delete freed;
+        freed = next;
+    }
+
+    sys = statmap::getSystem();
+    if(sys) {
+        orig = get();
+        sys->memory.active = orig ? (unsigned long)orig->memused : 0;
+        sys->memory.arena = arena;
+        sys->memory.generations = generations;
+        release(orig);
+    }
+    return !waiting;
 }
 
 void Driver::update(void)
 {
-    linked_pointer<keydata::keyvalue> kv;
-    keydata *keys = keyfile::get("script");
+    Script::stacking = settings.stacking;
+    Script::decimals = settings.decimals;
+    Script::stepping = settings.stepping;
+    Script::paging = settings.paging;
+    Script::sizing = settings.symbols;
+    Script::indexing = settings.indexing;
 
-    if(keys)
-        kv = keys->begin();
+    if(stats)
+        stats->throttle(settings.cps, settings.burst);
 
-    while(is(kv)) {
-        if(eq(kv->id, "stacking"))
-            Script::stacking = atoi(kv->value);
-        else if(eq(kv->id, "decimals"))
-            Script::decimals = atoi(kv->value);
-        else if(eq(kv->id, "stepping"))
-            Script::stepping = atoi(kv->value);
-        else if(eq(kv->id, "paging"))
-            Script::paging = atol(kv->value);
-        else if(eq(kv->id, "symbols"))
-            Script::sizing = atoi(kv->value);
-        else if(eq(kv->id, "indexing"))
-            Script::indexing = atoi(kv->value);
-        kv.next();
-    }
+    overload::update(keyfile::get("overload"));
 }
 
 void Driver::commit(Driver *driver)
@@ -270,75 +754,234 @@ void Driver::commit(Driver *driver)
         cb.next();
     }
 
-    locking.modify();
+    // the prior generation joins any still waiting to be reclaimed, so a
+    // reload never waits on readers of an older one; the swap is done
+    // under the reclaim lock so oldest always sees the prior generation
+    // as either active or retired...
+    reclaiming.lock();
     orig = active;
+    driver->parity = (epoch + 1) & 1;
+    __sync_synchronize();
     active = driver;
-    locking.commit();
+    __sync_fetch_and_add(&epoch, 1);
 
     if(orig) {
-        Thread::sleep(1000);
-        delete orig;
+        orig->retiring = retired;
+        retired = orig;
     }
+    reclaiming.unlock();
+}
+
+unsigned long Driver::oldest(void)
+{
+    unsigned long result;
+    Driver *orig;
+
+    reclaiming.lock();
+    result = active ? active->serial : serials;
+    for(orig = retired; orig; orig = orig->retiring) {
+        if(orig->serial < result)
+            result = orig->serial;
+    }
+    reclaiming.unlock();
+    return result;
+}
+
+void Driver::index(image *entry)
+{
+    unsigned path = NamedObject::keyindex(entry->id, image_indexing);
+
+    entry->indexed = image_index[path];
+    image_index[path] = entry;
+}
+
+Driver::image *Driver::find(const char *name)
+{
+    image *ip;
+
+    if(!image_indexing)
+        return NULL;
+
+    ip = image_index[NamedObject::keyindex(name, image_indexing)];
+    while(ip) {
+        if(eq(ip->id, name))
+            return ip;
+        ip = ip->indexed;
+    }
+    return NULL;
 }
 
 Script *Driver::getOutgoing(const char *name)
 {
     Driver *driver = get();
-    linked_pointer<image> ip;
     Script *scr = NULL;
+    image *ip;
 
     if(!driver)
         return NULL;
 
-    ip = driver->image_services;
-    while(is(ip)) {
-        if(eq(ip->id, name)) {
-            ip->ptr->retain();
+    // the entry flags are swapped with the image by a hot replace...
+    ip = driver->find(name);
+    if(ip) {
+        Mutex::protect(ip);
+        if(ip->outgoing) {
             scr = ip->ptr.get();
-            break;
+            scr->retain();
         }
-        ip.next();
+        Mutex::release(ip);
     }
     release(driver);
-    if(scr) {
-        if(Script::find(scr, "@outgoing"))
-            return scr;
-        scr->release();
+    return scr;
+}
+
+bool Driver::route(const char *dialed, char *name, size_t size, char *params, size_t psize)
+{
+    Driver *driver = get();
+    const dialplan::route_t *entry = NULL;
+
+    if(!driver)
+        return false;
+
+    if(driver->routes)
+        entry = driver->routes->find(dialed);
+
+    if(entry) {
+        String::set(name, size, entry->script);
+        if(params && psize) {
+            if(entry->params)
+                String::set(params, psize, entry->params);
+            else
+                params[0] = 0;
+        }
     }
-    return NULL;
+    release(driver);
+    return entry != NULL;
 }
 
 Script *Driver::getIncoming(const char *name)
 {
     Driver *driver = get();
-    linked_pointer<image> ip;
     Script *scr = NULL;
+    image *ip;
 
     if(!driver)
         return NULL;
 
-    ip = driver->image_services;
-    while(is(ip)) {
-        if(eq(ip->id, name)) {
-            ip->ptr->retain();
+    // the entry flags are swapped with the image by a hot replace...
+    ip = driver->find(name);
+    if(ip) {
+        Mutex::protect(ip);
+        if(ip->incoming) {
             scr = ip->ptr.get();
-            break;
+            scr->retain();
         }
-        ip.next();
+        Mutex::release(ip);
     }
     release(driver);
-    if(scr) {
-        if(Script::find(scr, "@incoming"))
-            return scr;
-        scr->release();
+    return scr;
+}
+
+bool Driver::isService(const char *name)
+{
+    Driver *driver = get();
+    bool result = false;
+
+    if(driver)
+        result = (driver->find(name) != NULL);
+    release(driver);
+    return result;
+}
+
+void Driver::recompile(const char *name)
+{
+    recompiler.post(name);
+}
+
+bool Driver::replace(const char *name)
+{
+    char path[256];
+    struct stat ino;
+    object_pointer<Script> def;
+    Driver *driver;
+    image *entry = NULL;
+    Script *img, *defs = NULL;
+    memalloc pager;
+    job_t *list;
+    unsigned count, pos;
+
+    snprintf(path, sizeof(path), "%s/%s.bcs", env("scripts"), name);
+    if(stat(path, &ino)) {
+        shell::log(shell::ERR, "%s: cannot recompile, missing", path);
+        return false;
     }
-    return NULL;
+
+    // we need not stay pinned while compiling, which would hold up a
+    // reload, as the entry is found again to swap into...
+    driver = get();
+    if(driver)
+        entry = driver->find(name);
+    release(driver);
+
+    if(!entry) {
+        shell::log(shell::ERR, "%s: not an active service, reload to add", name);
+        return false;
+    }
+
+    // calls may be running against the shared definitions of the active
+    // driver, so we compile against a private copy of our own...
+    list = scan(&pager, env("definitions"), &count);
+    if(list) {
+        for(pos = 0; pos < count; ++pos) {
+            snprintf(path, sizeof(path), "%s/%s.bcs", env("definitions"), list[pos].name);
+            defs = Script::compile(defs, path, NULL);
+        }
+        free(list);
+    }
+    def = defs;
+
+    snprintf(path, sizeof(path), "%s/%s.bcs", env("scripts"), name);
+    shell::log(shell::INFO, "recompiling %s.bcs", name);
+    img = Script::compile(NULL, path, *def);
+    if(!img) {
+        shell::log(shell::ERR, "%s: failed", path);
+        return false;
+    }
+
+    if(errors(img)) {
+        delete img;
+        return false;
+    }
+
+    // a reload may have happened while compiling, so swap into whichever
+    // driver is active now...
+    driver = get();
+    entry = NULL;
+    if(driver)
+        entry = driver->find(name);
+    if(entry) {
+        Mutex::protect(entry);
+        entry->ptr = img;
+        entry->defs = *def;
+        entry->modified = ino.st_mtime;
+        entry->size = ino.st_size;
+        entry->incoming = (Script::find(img, "@incoming") != NULL);
+        entry->outgoing = (Script::find(img, "@outgoing") != NULL);
+        Mutex::release(entry);
+    }
+    release(driver);
+
+    if(!entry) {
+        delete img;
+        return false;
+    }
+
+    shell::log(shell::NOTIFY, "replaced %s", name);
+    return true;
 }
 
 void Driver::release(keydata *keys)
 {
-    if(keys)
-        locking.release();
+    // keys are reached through a pinned driver, which is what is released
 }
 
 void Driver::release(Script *img)
@@ -350,8 +993,7 @@ void Driver::release(Script *img)
 void Driver::release(Driver *driver)
 {
     if(driver) {
-        driver->regfile.release();
-        locking.release();
+        __sync_fetch_and_sub(&pins[pinslot()].count[driver->parity], 1);
     }
 }
 
@@ -371,6 +1013,13 @@ const char *Driver::dispatch(char **argv, int pid)
         return "unknown resource";
     }
 
+    if(eq(argv[0], "compile")) {
+        if(!argv[1] || argv[2] || strchr(argv[1], '/') || strlen(argv[1]) >= 64)
+            return "missing or invalid argument";
+        recompile(argv[1]);
+        return NULL;
+    }
+
     if(eq(argv[0], "drop") || eq(argv[0], "hangup") || eq(argv[0], "enable") || eq(argv[0], "disable"))
         return "unknown resource";
 
@@ -441,6 +1090,13 @@ void Driver::start(void)
 {
     linked_pointer<Driver::callback> cb = callbacks;
 
+    // stats are created by the driver after the first commit, and the
+    // caller still has the first driver pinned...
+    if(stats && active)
+        stats->throttle(active->settings.cps, active->settings.burst);
+
+    if(active)
+        scriptmap::create(active->settings.tracking);
     dbi::start();
 
     while(is(cb)) {
@@ -521,4 +1177,14 @@ void Driver::release(statmap::stat_t stat)
         stats->release(stat);
 }
 
+bool Driver::admit(void)
+{
+    return !stats || stats->admit();
+}
+
+bool Driver::ready(void)
+{
+    return !stats || stats->ready();
+}
+
 } // end namespace
@@ -0,0 +1,227 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+
+#ifdef  HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+namespace bayonne {
+
+static struct
+{
+    volatile unsigned long lag, events, backlog;
+    unsigned long maxlag, maxevents, maxbacklog, maxcpu;
+    unsigned pressure, retry;
+    volatile overload::level_t level;
+    time_t sampled;
+    uint64_t cputime, walltime;
+} load = {0, 0, 0, 250, 64, 1000, 90, 0, 5, overload::NORMAL, 0, 0, 0};
+
+static unsigned percent(unsigned long value, unsigned long limit)
+{
+    if(!limit)
+        return 0;
+
+    return (unsigned)((value * 100l) / limit);
+}
+
+#ifdef  HAVE_SYS_RESOURCE_H
+static uint64_t usecs(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000l + tv->tv_usec;
+}
+
+static unsigned long cpu(void)
+{
+    static long cpus = 0;
+    struct rusage ru;
+    struct timeval now;
+    uint64_t cputime, walltime;
+    unsigned long result = 0;
+
+    if(!cpus) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if(cpus < 1)
+            cpus = 1;
+    }
+
+    gettimeofday(&now, NULL);
+    if(getrusage(RUSAGE_SELF, &ru))
+        return 0;
+
+    cputime = usecs(&ru.ru_utime) + usecs(&ru.ru_stime);
+    walltime = usecs(&now);
+    if(load.walltime && walltime > load.walltime)
+        result = (unsigned long)(((cputime - load.cputime) * 100l) / ((walltime - load.walltime) * cpus));
+    load.cputime = cputime;
+    load.walltime = walltime;
+    return result;
+}
+#else
+static unsigned long cpu(void)
+{
+    return 0;
+}
+#endif
+
+void overload::lag(timeout_t msecs)
+{
+    // only the background thread reports lag, so this is not contended...
+    if(msecs > load.lag)
+        load.lag = msecs;
+}
+
+void overload::queued(int diff)
+{
+    __sync_fetch_and_add(&load.events, (long)diff);
+}
+
+void overload::backlog(int diff)
+{
+    __sync_fetch_and_add(&load.backlog, (long)diff);
+}
+
+void overload::update(keydata *keys)
+{
+    const char *cp;
+
+    load.maxlag = 250;
+    load.maxevents = 64;
+    load.maxbacklog = 1000;
+    load.maxcpu = 90;
+    load.retry = 5;
+
+    if(!keys)
+        return;
+
+    cp = keys->get("lag");
+    if(cp)
+        load.maxlag = atol(cp);
+
+    cp = keys->get("events");
+    if(cp)
+        load.maxevents = atol(cp);
+
+    cp = keys->get("backlog");
+    if(cp)
+        load.maxbacklog = atol(cp);
+
+    cp = keys->get("cpu");
+    if(cp)
+        load.maxcpu = atol(cp);
+
+    cp = keys->get("retry");
+    if(cp)
+        load.retry = atoi(cp);
+}
+
+void overload::sample(void)
+{
+    static const char *names[] = {"normal", "elevated", "high", "critical"};
+
+    statmap *node = statmap::getSystem();
+    unsigned long usage;
+    unsigned current, value;
+    level_t level;
+    time_t now;
+
+    time(&now);
+    if(now == load.sampled)
+        return;
+
+    load.sampled = now;
+    usage = cpu();
+
+    current = percent(load.lag, load.maxlag);
+    value = percent(load.events, load.maxevents);
+    if(value > current)
+        current = value;
+    value = percent(load.backlog, load.maxbacklog);
+    if(value > current)
+        current = value;
+    value = percent(usage, load.maxcpu);
+    if(value > current)
+        current = value;
+
+    // rise at once, but decay gradually so a brief lull does not let a
+    // flood of new calls back in...
+    if(current >= load.pressure)
+        load.pressure = current;
+    else
+        load.pressure = (load.pressure * 3 + current) / 4;
+
+    if(load.pressure >= 150)
+        level = CRITICAL;
+    else if(load.pressure >= 100)
+        level = HIGH;
+    else if(load.pressure >= 75)
+        level = ELEVATED;
+    else
+        level = NORMAL;
+
+    if(level != load.level)
+        shell::log(level > load.level ? shell::WARN : shell::NOTIFY,
+            "overload %s; lag=%lu, events=%lu, backlog=%lu, cpu=%lu%%",
+            names[level], load.lag, load.events, load.backlog, usage);
+
+    load.level = level;
+
+    if(node) {
+        node->load.level = level;
+        node->load.pressure = load.pressure;
+        node->load.lag = load.lag;
+        node->load.events = load.events;
+        node->load.backlog = load.backlog;
+        node->load.cpu = usage;
+        node->load.maxlag = load.maxlag;
+        node->load.maxevents = load.maxevents;
+        node->load.maxbacklog = load.maxbacklog;
+        node->load.maxcpu = load.maxcpu;
+    }
+
+    load.lag = 0;
+}
+
+overload::level_t overload::level(void)
+{
+    return load.level;
+}
+
+bool overload::admit(unsigned priority, statmap *node)
+{
+    statmap *sys;
+
+    if(priority >= (unsigned)load.level)
+        return true;
+
+    sys = statmap::getSystem();
+    if(sys)
+        __sync_fetch_and_add(&sys->admission.shed, 1);
+    if(node && node != sys)
+        __sync_fetch_and_add(&node->admission.shed, 1);
+    return false;
+}
+
+unsigned overload::retry(void)
+{
+    if(load.level == NORMAL)
+        return load.retry;
+
+    return load.retry * (unsigned)load.level;
+}
+
+} // end namespace
@@ -17,10 +17,11 @@
 
 namespace bayonne {
 
-Registration::Registration(LinkedObject **list, keydata *keys, const char *sid) :
+Registration::Registration(LinkedObject **list, keydata *keys, const char *sid, statmap *node) :
 LinkedObject(list)
 {
     const char *cp = keys->get("limit");
+    unsigned cps = 0, burst = 0;
 
     id = keys->get();
 
@@ -29,12 +30,56 @@ LinkedObject(list)
     else
         limit = 0;
 
-    stats = statmap::getRegistry(id, limit);
+    cp = keys->get("cps");
+    if(cp)
+        cps = atoi(cp);
+
+    cp = keys->get("burst");
+    if(cp)
+        burst = atoi(cp);
+
+    cp = keys->get("priority");
+    if(cp)
+        priority = atoi(cp);
+    else
+        priority = overload::ELEVATED;
+
+    if(priority > overload::CRITICAL)
+        priority = overload::CRITICAL;
+
+    // a replaced registration keeps its stats...
+    if(node) {
+        stats = node;
+        stats->timeslots = limit;
+    }
+    else
+        stats = statmap::getRegistry(id, limit);
+    if(stats)
+        stats->throttle(cps, burst);
     activated = 0;
+    keysum = signature(keys);
     id = memcopy(id);
     schema = sid;
 }
 
+unsigned long Registration::signature(keydata *keys)
+{
+    linked_pointer<keydata::keyvalue> kv = keys->begin();
+    unsigned long hash = 2166136261ul;
+    const char *cp;
+
+    while(is(kv)) {
+        for(cp = kv->id; *cp; ++cp)
+            hash = (hash ^ (unsigned char)*cp) * 16777619ul;
+        hash = (hash ^ '=') * 16777619ul;
+        for(cp = kv->value; *cp; ++cp)
+            hash = (hash ^ (unsigned char)*cp) * 16777619ul;
+        hash = (hash ^ '\n') * 16777619ul;
+        kv.next();
+    }
+    return hash;
+}
+
 void Registration::release(void)
 {
     activated = 0;
@@ -97,12 +142,32 @@ bool Registration::attach(statmap::stat_t stat)
     Mutex::protect(stats);
     if(!limit || limit > stats->active())
         stats->update(stat);
-    else
+    else {
+        ++stats->admission.limited;
         rtn = false;
+    }
     Mutex::release(stats);
+
+    // rolling windows are updated lock-free, outside the node lock...
+    if(rtn)
+        stats->record(true);
     return rtn;
 }
 
+bool Registration::ready(void)
+{
+    if(priority < (unsigned)overload::level())
+        return false;
+
+    if(!stats)
+        return true;
+
+    if(limit && limit <= stats->active())
+        return false;
+
+    return stats->ready();
+}
+
 void Registration::release(statmap::stat_t stat)
 {
     if(stats)
@@ -369,12 +369,10 @@ static bool isTimeslot(const char *cp)
     return true;
 }
 
-bool server::period(long slice)
+bool server::period(long slice, statmap::format_t format)
 {
     assert(slice > 0);
 
-    FILE *fp = NULL;
-    char buf[256];
     time_t now, next;
 
     slice *= 60l;   // convert to minute intervals...
@@ -385,14 +383,8 @@ bool server::period(long slice)
 
     next = (now / slice) * slice;
 
-    fp = fopen(env("stats"), "a");
-    if(fp) {
-        DateTimeString dt(periodic);
-        fprintf(fp, "%s %ld\n", buf, (long)(next - periodic));
-    }
-    statmap::period(fp);
-    if(fp)
-        fclose(fp);
+    statmap::period(env("stats"), periodic, next, format);
+    periodic = next;
     return true;
 }
 
@@ -549,6 +541,7 @@ void server::parse(int argc, char **argv, const char *dname)
     time(&periodic);
 
     shell::bind("bayonne");
+    secure::init();
     corefiles();
 
 #if defined(DEBUG)
@@ -592,6 +585,7 @@ void server::parse(int argc, char **argv, const char *dname)
     set("calls", _STR(str(prefix) + "/logs/bayonne.calls"));
     set("stats", _STR(str(prefix) + "/logs/bayonne.stats"));
     set("prefix", rundir);
+    set("spool", _STR(str(rundir) + "/spool"));
     set("definitions", _STR(str(prefix) + "/definitions"));
     set("shell", "cmd.exe");
     prefix = rundir;
@@ -615,6 +609,7 @@ void server::parse(int argc, char **argv, const char *dname)
     set("calls", DEFAULT_VARPATH "/log/bayonne.calls");
     set("stats", DEFAULT_VARPATH "/log/bayonne.stats");
     set("prefix", DEFAULT_VARPATH "/lib/bayonne");
+    set("spool", DEFAULT_VARPATH "/spool/bayonne");
     set("definitions", DEFAULT_DATADIR "/bayonne");
     set("shell", "/bin/sh");
 #endif
@@ -654,6 +649,7 @@ void server::parse(int argc, char **argv, const char *dname)
         set("calls", _STR(str(rundir) + "/calls"));
         set("stats", _STR(str(rundir) + "/stats"));
         set("prefix", prefix);
+        set("spool", _STR(str(prefix) + "/spool"));
         set("shell", pwd->pw_shell);
     }
 
@@ -837,9 +833,15 @@ void server::startup(shell::mainproc_t proc, bool detached)
     if(uid)
         setuid(uid);
 #endif
+}
 
-    if(is(restart))
-        args.restart();
+bool server::restart(void)
+{
+    if(!is(bayonne::restart))
+        return false;
+
+    args.restart();
+    return true;
 }
 
 void server::stop(void)
@@ -940,9 +942,18 @@ invalid:
         }
 
         if(eq(argv[0], "period")) {
-            if(argc != 2)
+            statmap::format_t format = statmap::TEXT;
+            if(argc < 2 || argc > 3 || atol(argv[1]) < 1)
                 goto invalid;
-            if(server::period(atol(argv[1]))) {
+            if(argc == 3) {
+                if(eq(argv[2], "csv"))
+                    format = statmap::CSV;
+                else if(eq(argv[2], "json"))
+                    format = statmap::JSON;
+                else if(!eq(argv[2], "text"))
+                    goto invalid;
+            }
+            if(server::period(atol(argv[1]), format)) {
                 server::printlog("server period %s", (const char *)dt);
             }
             continue;
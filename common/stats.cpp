@@ -28,6 +28,52 @@ public:
     void init(void);
 } shm;
 
+static unsigned scripts = 0;
+
+static class __LOCAL scr : public mapped_array<scriptmap>
+{
+public:
+    scr();
+    ~scr();
+} scriptshm;
+
+typedef struct
+{
+    char id[8];
+    unsigned type;
+    unsigned long period[2];
+    unsigned short min[2], max[2];
+    time_t lastcall;
+} record_t;
+
+typedef struct snapshot
+{
+    struct snapshot *next;
+    const char *path;
+    time_t started, ended;
+    statmap::format_t format;
+    unsigned count;
+    record_t records[1];
+} snapshot_t;
+
+static class __LOCAL periodic : public DetachedThread, public Conditional
+{
+public:
+    periodic();
+
+    void post(snapshot_t *snap);
+
+private:
+    snapshot_t *pending, *last;
+    bool running;
+    FILE *fp;
+
+    void exit(void);
+    void run(void);
+    void open(const char *path);
+    void write(snapshot_t *snap);
+} writer;
+
 sta::sta() : mapped_array<statmap>()
 {
 }
@@ -58,6 +104,14 @@ statmap *statmap::create(unsigned total)
     return node;
 }
 
+statmap *statmap::getSystem(void)
+{
+    if(!count)
+        return NULL;
+
+    return shm(0);
+}
+
 statmap *statmap::getBoard(unsigned id)
 {
     Board *board = Driver::getBoard(id);
@@ -99,16 +153,200 @@ statmap *statmap::getRegistry(const char *id, unsigned timeslots)
     return node;
 }
 
+periodic::periodic() : DetachedThread(), Conditional()
+{
+    pending = last = NULL;
+    running = false;
+    fp = NULL;
+}
+
+void periodic::exit(void)
+{
+}
+
+void periodic::post(snapshot_t *snap)
+{
+    Conditional::lock();
+    if(last)
+        last->next = snap;
+    else
+        pending = snap;
+    last = snap;
+    if(!running) {
+        running = true;
+        start();
+    }
+    Conditional::signal();
+    Conditional::unlock();
+}
+
+void periodic::open(const char *path)
+{
+    struct stat ino, cur;
+
+    // the stats file is kept open, but logrotate may move it away...
+    if(fp && (stat(path, &ino) || fstat(fileno(fp), &cur) ||
+        ino.st_ino != cur.st_ino || ino.st_dev != cur.st_dev)) {
+        fclose(fp);
+        fp = NULL;
+    }
+
+    if(!fp)
+        fp = fopen(path, "a");
+}
+
+void periodic::write(snapshot_t *snap)
+{
+    record_t *rec;
+    char node[16];
+    unsigned pos = 0;
+
+    open(snap->path);
+    if(!fp)
+        return;
+
+    if(snap->format == statmap::TEXT) {
+        DateTimeString dt(snap->started);
+        fprintf(fp, "%s %ld\n", (const char *)dt, (long)(snap->ended - snap->started));
+    }
+
+    while(pos < snap->count) {
+        rec = &snap->records[pos++];
+        if(rec->type == statmap::BOARD)
+            snprintf(node, sizeof(node), "board/%s", rec->id);
+        else if(rec->type == statmap::SPAN)
+            snprintf(node, sizeof(node), "span/%s", rec->id);
+        else if(rec->type == statmap::REGISTRY)
+            snprintf(node, sizeof(node), "net/%s", rec->id);
+        else
+            String::set(node, sizeof(node), "system");
+
+        switch(snap->format) {
+        case statmap::CSV:
+            fprintf(fp, "%ld,%ld,%s,%lu,%hu,%hu,%lu,%hu,%hu,%ld\n",
+                (long)snap->started, (long)(snap->ended - snap->started), node,
+                rec->period[0], rec->min[0], rec->max[0],
+                rec->period[1], rec->min[1], rec->max[1], (long)rec->lastcall);
+            break;
+        case statmap::JSON:
+            for(char *cp = node; *cp; ++cp) {
+                if(*cp == '\"' || *cp == '\\' || *cp < 32)
+                    *cp = '_';
+            }
+            fprintf(fp, "{\"time\":%ld,\"interval\":%ld,\"node\":\"%s\","
+                "\"incoming\":{\"calls\":%lu,\"min\":%hu,\"max\":%hu},"
+                "\"outgoing\":{\"calls\":%lu,\"min\":%hu,\"max\":%hu},"
+                "\"lastcall\":%ld}\n",
+                (long)snap->started, (long)(snap->ended - snap->started), node,
+                rec->period[0], rec->min[0], rec->max[0],
+                rec->period[1], rec->min[1], rec->max[1], (long)rec->lastcall);
+            break;
+        default:
+            fprintf(fp, " %-12s %09lu %05hu %05hu %09lu %05hu %05hu %ld\n", node,
+                rec->period[0], rec->min[0], rec->max[0],
+                rec->period[1], rec->min[1], rec->max[1], (long)rec->lastcall);
+        }
+    }
+    fflush(fp);
+}
+
+void periodic::run(void)
+{
+    snapshot_t *snap, *next;
+
+    shell::log(shell::DEBUG0, "starting stats writer");
+
+    for(;;) {
+        Conditional::lock();
+        if(!pending)
+            Conditional::wait();
+        snap = pending;
+        pending = last = NULL;
+        Conditional::unlock();
+
+        while(snap) {
+            next = snap->next;
+            write(snap);
+            free(snap);
+            snap = next;
+        }
+    }
+}
+
 unsigned statmap::active(void) const
 {
     return stats[0].current + stats[1].current;
 }
 
+// slots are updated lock-free since they are also sampled from other
+// processes through the mapped view; an epoch change resets the slot.
+
+static void tally(volatile uint64_t *slot, uint64_t epoch)
+{
+    uint64_t prior, next;
+
+    epoch &= 0xffffffff;
+    do {
+        prior = *slot;
+        if((prior >> 32) == epoch)
+            next = prior + 1;
+        else
+            next = (epoch << 32) | 1;
+    } while(!__sync_bool_compare_and_swap(slot, prior, next));
+}
+
+static void peak(volatile uint64_t *slot, uint64_t epoch, unsigned value)
+{
+    uint64_t prior, next;
+
+    epoch &= 0xffffffff;
+    do {
+        prior = *slot;
+        if((prior >> 32) == epoch && (prior & 0xffffffff) >= value)
+            return;
+        next = (epoch << 32) | value;
+    } while(!__sync_bool_compare_and_swap(slot, prior, next));
+}
+
+void statmap::record(bool attempt)
+{
+    time_t now;
+    uint64_t epoch;
+    unsigned current = active();
+
+    time(&now);
+    for(unsigned window = 0; window < STAT_WINDOWS; ++window) {
+        epoch = (uint64_t)(now / resolution((window_t)window));
+        if(attempt)
+            tally(&windows[window].calls[epoch % STAT_SLOTS], epoch);
+        peak(&windows[window].peak[epoch % STAT_SLOTS], epoch, current);
+    }
+}
+
+void statmap::sample(void)
+{
+    static time_t sampled = 0;
+    unsigned pos = 0;
+    time_t now;
+
+    time(&now);
+    if(now == sampled)
+        return;
+
+    sampled = now;
+    while(pos < count) {
+        statmap *node = shm(pos++);
+        if(node->type != UNUSED)
+            node->record(false);
+    }
+}
+
 void statmap::assign(stat_t entry)
 {
     Mutex::protect(this);
     update(entry);
     Mutex::release(this);
+    record(true);
 }
 
 void statmap::update(stat_t entry)
@@ -131,51 +369,209 @@ void statmap::release(stat_t entry)
     if(stats[entry].current < stats[entry].min)
         stats[entry].min = stats[entry].current;
     Mutex::release(this);
+    record(false);
 }
 
-void statmap::period(FILE *fp)
+void statmap::throttle(unsigned cps, unsigned burst)
 {
+    if(!burst)
+        burst = cps;
+
+    Mutex::protect(this);
+    if(cps) {
+        admission.interval = 1000000l / cps;
+        admission.tolerance = admission.interval * (burst - 1);
+    }
+    else
+        admission.interval = admission.tolerance = 0;
+    Mutex::release(this);
+}
+
+bool statmap::admit(void)
+{
+    struct timeval now;
+    uint64_t prior, arrival, current;
+    unsigned long interval = admission.interval;
+
+    if(!interval)
+        return true;
+
+    gettimeofday(&now, NULL);
+    current = (uint64_t)now.tv_sec * 1000000l + now.tv_usec;
+
+    do {
+        prior = arrival = admission.arrival;
+        if(arrival < current)
+            arrival = current;
+        if(arrival - current > admission.tolerance) {
+            __sync_fetch_and_add(&admission.throttled, 1);
+            return false;
+        }
+    } while(!__sync_bool_compare_and_swap(&admission.arrival, prior, arrival + interval));
+    return true;
+}
+
+bool statmap::ready(void) const
+{
+    struct timeval now;
+    uint64_t arrival = admission.arrival, current;
+
+    if(!admission.interval)
+        return true;
+
+    gettimeofday(&now, NULL);
+    current = (uint64_t)now.tv_sec * 1000000l + now.tv_usec;
+    return arrival <= current || arrival - current <= admission.tolerance;
+}
+
+void statmap::period(const char *path, time_t started, time_t ended, format_t format)
+{
+    snapshot_t *snap = NULL;
     unsigned pos = 0;
-    char text[80];
-    size_t len;
-    time_t last;
+    record_t *rec;
+
+    if(path)
+        snap = (snapshot_t *)malloc(sizeof(snapshot_t) + sizeof(record_t) * count);
+
+    if(snap) {
+        snap->next = NULL;
+        snap->path = path;
+        snap->started = started;
+        snap->ended = ended;
+        snap->format = format;
+        snap->count = 0;
+    }
 
+    // only the shard swap is done under the node lock, formatting and
+    // file output are left for the writer thread...
     while(pos < count) {
         statmap *node = shm(pos++);
         if(node->type == UNUSED)
             continue;
 
-        if(fp) {
-            if(node->type == statmap::BOARD)
-                snprintf(text, sizeof(text), " board/%-6s", node->id);
-            else if(node->type == statmap::SPAN)
-                snprintf(text, sizeof(text), " span/%-7s", node->id);
-            else if(node->type == statmap::REGISTRY)
-                snprintf(text, sizeof(text), " net/%-8s", node->id);
-            else
-                snprintf(text, sizeof(text), " system      ");
-            len = strlen(text);
+        rec = NULL;
+        if(snap) {
+            rec = &snap->records[snap->count++];
+            rec->type = node->type;
+            String::set(rec->id, sizeof(rec->id), node->id);
         }
-        else
-            len = 0;
 
         Mutex::protect(node);
         for(unsigned entry = 0; entry < 2; ++entry) {
-            if(fp) {
-                snprintf(text + len, sizeof(text) - len, " %09lu %05hu %05hu",
-                node->stats[entry].period, node->stats[entry].min, node->stats[entry].max);
-                len = strlen(text);
-            }
             node->stats[entry].pperiod = node->stats[entry].period;
             node->stats[entry].pmax = node->stats[entry].max;
             node->stats[entry].pmin = node->stats[entry].min;
             node->stats[entry].max = node->stats[entry].min = node->stats[entry].current;
             node->stats[entry].period = 0;
         }
-        last = node->lastcall;
+        if(rec) {
+            for(unsigned entry = 0; entry < 2; ++entry) {
+                rec->period[entry] = node->stats[entry].pperiod;
+                rec->min[entry] = node->stats[entry].pmin;
+                rec->max[entry] = node->stats[entry].pmax;
+            }
+            rec->lastcall = node->lastcall;
+        }
         Mutex::release(node);
-        if(fp)
-            fprintf(fp, "%s %ld\n", text, (long)last);
+    }
+
+    if(snap)
+        writer.post(snap);
+}
+
+scr::scr() : mapped_array<scriptmap>()
+{
+}
+
+scr::~scr()
+{
+    if(scripts) {
+        release();
+        remove(SCRIPT_MAP);
+    }
+}
+
+static unsigned hash(const char *id)
+{
+    unsigned key = 2166136261u;
+
+    while(*id) {
+        key ^= (unsigned char)*(id++);
+        key *= 16777619u;
+    }
+    return key;
+}
+
+void scriptmap::create(unsigned count)
+{
+    if(scripts || !count)
+        return;
+
+    scripts = count;
+    scriptshm.remove(SCRIPT_MAP);
+    scriptshm.create(SCRIPT_MAP, count);
+    scriptshm.initialize();
+}
+
+scriptmap *scriptmap::get(type_t type, const char *id)
+{
+    unsigned pos, probe = 0;
+    scriptmap *node;
+
+    if(!scripts || !id || !*id)
+        return NULL;
+
+    pos = (hash(id) + (unsigned)type) % scripts;
+    while(probe++ < scripts) {
+        node = scriptshm(pos);
+        if(++pos >= scripts)
+            pos = 0;
+
+        if(node->type == UNUSED && __sync_bool_compare_and_swap(&node->type, UNUSED, CLAIMED)) {
+            String::set(node->id, sizeof(node->id), id);
+            __sync_synchronize();
+            node->type = type;
+            return node;
+        }
+
+        // another thread is filling in this entry...
+        while(node->type == CLAIMED)
+            Thread::yield();
+
+        if(node->type == (unsigned)type && eq(node->id, id))
+            return node;
+    }
+    return NULL;
+}
+
+void scriptmap::assign(void)
+{
+    __sync_fetch_and_add(&attempts, 1);
+    __sync_fetch_and_add(&active, 1);
+}
+
+void scriptmap::release(time_t seconds, const char *reason, bool scripted)
+{
+    unsigned key = hash(reason) | 1;
+
+    if(scripted) {
+        __sync_fetch_and_sub(&active, 1);
+        __sync_fetch_and_add(&completed, 1);
+        __sync_fetch_and_add(&duration, (unsigned long)seconds);
+    }
+    else {
+        __sync_fetch_and_add(&attempts, 1);
+        __sync_fetch_and_add(&failed, 1);
+    }
+
+    // reasons past the slots kept are only counted in the totals...
+    for(unsigned slot = 0; slot < SCRIPT_REASONS; ++slot) {
+        if(!reasons[slot].key && __sync_bool_compare_and_swap(&reasons[slot].key, 0, key))
+            String::set(reasons[slot].id, sizeof(reasons[slot].id), reason);
+        if(reasons[slot].key == key) {
+            __sync_fetch_and_add(&reasons[slot].count, 1);
+            return;
+        }
     }
 }
 
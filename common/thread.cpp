@@ -25,6 +25,14 @@ static struct
     Background *thread;
 } bk = {false, false, 500, NULL};
 
+static timeout_t msecs(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (timeout_t)(now.tv_sec * 1000l + now.tv_usec / 1000l);
+}
+
 Background::Background(size_t stack) : DetachedThread(stack), Conditional()
 {
     bk.thread = this;
@@ -85,7 +93,7 @@ void Background::exit(void)
 
 void Background::run(void)
 {
-    timeout_t timeout, current;
+    timeout_t timeout, current, waited, mark;
     Timeslot *ts;
     unsigned tsid;
     time_t now;
@@ -104,9 +112,12 @@ void Background::run(void)
             return; // exit thread...
         }
         timeout = expires.get();
+        waited = 0;
+        mark = msecs();
         if(!bk.signalled && timeout) {
             if(timeout > bk.slice)
                 timeout = bk.slice;
+            waited = timeout;
             Conditional::wait(timeout);
         }
         timeout = expires.get();
@@ -130,6 +141,13 @@ void Background::run(void)
             Conditional::unlock();
         }
         automatic();
+
+        // lateness past the scheduled wakeup, including sweep time...
+        current = msecs() - mark;
+        overload::lag(current > waited ? current - waited : 0);
+        overload::sample();
+        statmap::sample();
+        Driver::reclaim();
     }
 }
 
@@ -61,6 +61,7 @@ Timeslot::Timeslot() : LinkedObject(&timeslots), Script::interp()
     registry = NULL;
     board = NULL;
     span = NULL;
+    scripted = targeted = NULL;
     instance = counting++;
     sequence = rings = 0;
     expires = Timer::inf;
@@ -96,14 +97,7 @@ void Timeslot::initialize(void)
     digits = voice = NULL;
     Script::symbol *sym;
     Driver *driver = Driver::get();
-    keydata *keys = driver->keyfile::get("defaults");
-    const char *default_voice = NULL;
-
-    if(keys)
-        default_voice = keys->get("voice");
-
-    if(!default_voice)
-        default_voice = "english/female";
+    const char *default_voice = driver->getSettings()->voice;
 
     interp::initialize();
     sym = createSymbol("digits:64");
@@ -177,6 +171,11 @@ void Timeslot::allocate(long new_cid, statmap::stat_t stat, Registration *reg)
     dbi::post(call);
 }
 
+bool Timeslot::available(void)
+{
+    return timeslots != NULL;
+}
+
 Timeslot *Timeslot::assign(Registration *reg, statmap::stat_t stat, long cid)
 {
     Timeslot *ts = NULL;
@@ -231,26 +230,46 @@ void Timeslot::release(event_t *event)
 {
     unsigned path = (cid % TIMESLOT_INDEX_SIZE);
     time_t ending;
+    long duration;
     dbi *call = dbi::get();
 
     if(!reason)
         reason = "release";
 
     time(&ending);
+    duration = (long)(ending - mapped->started);
 
     call->type = dbi::STOP;
     call->optional = optional;
     call->timeslot = instance;
     call->sequence = sequence;
     call->starting = mapped->started;
-    call->duration = (long)(ending - mapped->started);
+    call->duration = duration;
 
     String::set(call->reason, sizeof(call->reason), reason);
     String::set(call->source, sizeof(call->source), mapped->source);
     String::set(call->target, sizeof(call->target), mapped->target);
     String::set(call->script, sizeof(call->script), mapped->script);
+    // the record belongs to the dbi thread once posted...
     dbi::post(call);
 
+    // calls that never started their script are counted as failed...
+    if(scripted)
+        scripted->release(duration, reason, true);
+    else if(!eq(mapped->script, "-")) {
+        scriptmap *node = scriptmap::get(scriptmap::SCRIPT, mapped->script);
+        if(node)
+            node->release(duration, reason, false);
+    }
+    if(targeted)
+        targeted->release(duration, reason, true);
+    else if(!scripted && !eq(mapped->target, "-")) {
+        scriptmap *node = scriptmap::get(scriptmap::TARGET, mapped->target);
+        if(node)
+            node->release(duration, reason, false);
+    }
+    scripted = targeted = NULL;
+
     digits = voice = NULL;
     event->id = Timeslot::RELEASE;
     detach();
@@ -314,6 +333,45 @@ void Timeslot::scriptHandler(event_t *event)
     }
 }
 
+void Timeslot::dialHandler(event_t *event)
+{
+    switch(event->id) {
+    case Timeslot::DISABLE:
+        disable(event);
+        break;
+    case Timeslot::RINGING:
+        if(!rings++)
+            setMapped('r', "ringback");
+        break;
+    case Timeslot::ANSWER:
+        disarm();
+        connect(event);
+        break;
+    case Timeslot::FAILED:
+        reason = (const char *)event->data;
+        if(!reason)
+            reason = "failed";
+        disconnect(event);
+        release(event);
+        break;
+    case Timeslot::TIMEOUT:
+        reason = "noanswer";
+        hangup(event);
+        release(event);
+        break;
+    case Timeslot::DROP:
+        reason = "failed";
+        disconnect(event);
+        break;
+    case Timeslot::RELEASE:
+        release(event);
+        break;
+    default:
+        event->id = Timeslot::REJECT;
+        break;
+    }
+}
+
 void Timeslot::offlineHandler(event_t *event)
 {
     switch(event->id) {
@@ -397,6 +455,12 @@ void Timeslot::enable(event_t *event)
     event->id = Timeslot::RELEASE;
 }
 
+void Timeslot::connect(event_t *event)
+{
+    connected = answered = true;
+    setScripting();
+}
+
 void Timeslot::running(event_t *event)
 {
     event->id = Timeslot::REJECT;
@@ -428,11 +492,37 @@ void Timeslot::disable(event_t *event)
 
 void Timeslot::setScripting(void)
 {
+    if(!scripted && !eq(mapped->script, "-")) {
+        scripted = scriptmap::get(scriptmap::SCRIPT, mapped->script);
+        if(scripted)
+            scripted->assign();
+        if(!eq(mapped->target, "-"))
+            targeted = scriptmap::get(scriptmap::TARGET, mapped->target);
+        if(targeted)
+            targeted->assign();
+    }
+
     setMapped('$', "script");
     handler = &Timeslot::scriptHandler;
     arm(Driver::getStepping());
 }
 
+void Timeslot::setDialing(timeout_t timeout)
+{
+    setMapped('d', "dialing");
+    handler = &Timeslot::dialHandler;
+    arm(timeout);
+}
+
+void Timeslot::rebind(long new_cid)
+{
+    private_locking.modify();
+    delist(&assigned[cid % TIMESLOT_INDEX_SIZE]);
+    cid = new_cid;
+    enlist(&assigned[cid % TIMESLOT_INDEX_SIZE]);
+    private_locking.commit();
+}
+
 void Timeslot::setIdle(void)
 {
     setMapped('-', "idle");
@@ -0,0 +1,248 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+
+#ifdef  HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+namespace bayonne {
+
+#ifdef  HAVE_SYS_INOTIFY_H
+
+#define WATCH_PENDING   32
+#define WATCH_EVENTS    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+// watches config, configs, definitions, and scripts for changes, and
+// after a quiet period either replaces changed services or reloads...
+static class __LOCAL watcher : public Driver::callback, public JoinableThread, protected Env
+{
+public:
+    watcher();
+
+private:
+    int fd;
+    int wd_config, wd_configs, wd_defs, wd_scripts;
+    const char *config;
+    timeout_t debounce;
+    volatile bool running;
+
+    bool reloading;
+    unsigned pending;
+    char scripts[WATCH_PENDING][64];
+
+    void start(void);
+    void stop(void);
+    void run(void);
+    void changed(struct inotify_event *event);
+    void flush(void);
+} monitor;
+
+watcher::watcher() : Driver::callback(), JoinableThread(), Env()
+{
+    fd = -1;
+    wd_config = wd_configs = wd_defs = wd_scripts = -1;
+    config = NULL;
+    debounce = 0;
+    running = false;
+    reloading = false;
+    pending = 0;
+}
+
+void watcher::start(void)
+{
+    char dirpath[256];
+    char *cp;
+    Driver *driver = Driver::get();
+
+    if(driver)
+        debounce = driver->getSettings()->watching;
+    Driver::release(driver);
+
+    if(!debounce)
+        return;
+
+    fd = inotify_init();
+    if(fd < 0) {
+        shell::log(shell::ERR, "cannot watch for config changes");
+        return;
+    }
+
+    // editors often replace the config file, so its directory is watched
+    String::set(dirpath, sizeof(dirpath), env("config"));
+    cp = strrchr(dirpath, '/');
+    if(cp) {
+        *cp = 0;
+        config = strrchr(env("config"), '/') + 1;
+        wd_config = inotify_add_watch(fd, dirpath, WATCH_EVENTS);
+    }
+
+    wd_configs = inotify_add_watch(fd, env("configs"), WATCH_EVENTS);
+    wd_defs = inotify_add_watch(fd, env("definitions"), WATCH_EVENTS);
+    wd_scripts = inotify_add_watch(fd, env("scripts"), WATCH_EVENTS);
+
+    running = true;
+    JoinableThread::start();
+}
+
+void watcher::stop(void)
+{
+    if(!running)
+        return;
+
+    running = false;
+    join();
+    ::close(fd);
+    fd = -1;
+}
+
+void watcher::changed(struct inotify_event *event)
+{
+    char name[64];
+    char *ext;
+    unsigned pos;
+
+    // changes were dropped from the queue, so we cannot tell which...
+    if(event->mask & IN_Q_OVERFLOW) {
+        reloading = true;
+        return;
+    }
+
+    if(!event->len || event->name[0] == '.')
+        return;
+
+    // editor backup files...
+    if(event->name[strlen(event->name) - 1] == '~')
+        return;
+
+    // the config file may live in the configs directory, and then both
+    // share one watch descriptor...
+    if(event->wd == wd_config) {
+        if(config && eq(event->name, config)) {
+            reloading = true;
+            return;
+        }
+        if(event->wd != wd_configs)
+            return;
+    }
+
+    // only compiled script sources matter in script directories...
+    ext = strrchr(event->name, '.');
+    if(event->wd != wd_configs && (!ext || !eq(ext, ".bcs")))
+        return;
+
+    if(event->wd != wd_scripts) {
+        reloading = true;
+        return;
+    }
+
+    // a script deleted or moved away cannot be recompiled in place, and
+    // its old image would stay live...
+    if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        reloading = true;
+        return;
+    }
+
+    String::set(name, sizeof(name), event->name);
+    ext = strrchr(name, '.');
+    if(ext)
+        *ext = 0;
+
+    for(pos = 0; pos < pending; ++pos) {
+        if(eq(scripts[pos], name))
+            return;
+    }
+
+    if(pending >= WATCH_PENDING) {
+        reloading = true;
+        return;
+    }
+    String::set(scripts[pending++], sizeof(scripts[0]), name);
+}
+
+void watcher::flush(void)
+{
+    unsigned pos;
+
+    // a script that is new or removed changes the service index...
+    for(pos = 0; !reloading && pos < pending; ++pos) {
+        if(!Driver::isService(scripts[pos]))
+            reloading = true;
+    }
+
+    if(reloading) {
+        shell::log(shell::NOTIFY, "reloading for changed files");
+        Driver::reload();
+    }
+    else for(pos = 0; pos < pending; ++pos)
+        Driver::recompile(scripts[pos]);
+
+    reloading = false;
+    pending = 0;
+}
+
+void watcher::run(void)
+{
+    char buffer[4096];
+    struct pollfd pfd;
+    struct inotify_event *event;
+    ssize_t len, pos;
+    Driver *driver;
+    int timeout;
+    bool waiting = false;
+
+    shell::log(shell::DEBUG0, "starting file watcher");
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while(running) {
+        // changes are only acted on once quiet for the debounce period,
+        // otherwise we wake each second so stop is noticed...
+        timeout = 1000;
+        if(waiting)
+            timeout = debounce;
+
+        pfd.revents = 0;
+        if(poll(&pfd, 1, timeout) < 1) {
+            if(waiting)
+                flush();
+            waiting = false;
+            continue;
+        }
+
+        len = ::read(fd, buffer, sizeof(buffer));
+        pos = 0;
+        while(len > 0 && pos < len) {
+            event = (struct inotify_event *)(buffer + pos);
+            changed(event);
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+
+        waiting = (reloading || pending);
+
+        // debounce may change with the config...
+        driver = Driver::get();
+        if(driver && driver->getSettings()->watching)
+            debounce = driver->getSettings()->watching;
+        Driver::release(driver);
+    }
+}
+
+#endif
+
+} // end namespace
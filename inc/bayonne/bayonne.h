@@ -48,6 +48,8 @@
 #include <bayonne/driver.h>
 #include <bayonne/thread.h>
 #include <bayonne/stats.h>
+#include <bayonne/overload.h>
+#include <bayonne/dialplan.h>
 #include <bayonne/dbi.h>
 #include <bayonne/uri.h>
 #endif
@@ -0,0 +1,92 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * Dialplan routing of inbound calls.
+ * A dialplan maps dialed number prefixes and ranges to the script that
+ * answers them.  It is compiled into a packed digit trie when a driver
+ * generation is created, and so is replaced with the generation on reload.
+ * @file bayonne/dialplan.h
+ */
+
+#ifndef _BAYONNE_DIALPLAN_H_
+#define _BAYONNE_DIALPLAN_H_
+
+#ifndef _UCOMMON_LINKED_H_
+#include <ucommon/linked.h>
+#endif
+
+#ifndef _UCOMMON_MEMORY_H_
+#include <ucommon/memory.h>
+#endif
+
+#ifndef _BAYONNE_NAMESPACE_H_
+#include <bayonne/namespace.h>
+#endif
+
+namespace bayonne {
+
+class __EXPORT dialplan
+{
+public:
+    typedef struct {
+        const char *script;
+        const char *params;     // name=value symbols for script, or NULL
+    } route_t;
+
+private:
+    // nodes hold no pointers; children of a node are stored together
+    // in digit order, starting at first...
+    typedef struct {
+        uint16_t map;           // bit for each dial symbol with a child
+        int32_t route;          // index of route, or -1
+        uint32_t first;         // index of first child
+    } node_t;
+
+    node_t *nodes;
+    route_t *routes;
+    unsigned node_count, route_count;
+
+    dialplan();
+
+public:
+    /**
+     * Compile a dialplan file.  Each line has a dialed prefix, or a
+     * range of equal length numbers such as 5551000-5551999, followed by
+     * the script to use and optional name=value symbols.  Comments start
+     * with ";".
+     * @param arena to allocate dialplan from.
+     * @param path of dialplan file.
+     * @return dialplan or NULL if none or empty.
+     */
+    static dialplan *create(memalloc *arena, const char *path);
+
+    /**
+     * Find the route for the longest matching prefix of a dialed number.
+     * @param dialed number to route.
+     * @return route or NULL if none matched.
+     */
+    const route_t *find(const char *dialed) const;
+
+    inline unsigned getRoutes(void) const
+        {return route_count;}
+
+    inline unsigned getNodes(void) const
+        {return node_count;}
+};
+
+} // end namespace
+
+#endif
@@ -65,6 +65,10 @@
 #include <bayonne/registry.h>
 #endif
 
+#ifndef _BAYONNE_DIALPLAN_H_
+#include <bayonne/dialplan.h>
+#endif
+
 namespace bayonne {
 
 /**
@@ -78,6 +82,10 @@ class __EXPORT Driver : public keyfile, protected Env
 {
 private:
     keyfile regfile;
+    unsigned parity;    // epoch parity readers pin this driver with
+    Driver *retiring;   // next older generation waiting for reclaim
+    unsigned long serial;   // generations are numbered as created
+    size_t memused;     // bytes allocated from this generation
 
 public:
     /**
@@ -161,13 +169,79 @@ protected:
         image(Script *img, LinkedObject **root, const char *name);
 
         object_pointer<Script> ptr;
+        object_pointer<Script> defs;    // definitions compiled against
         const char *id;
         const char *path;
+        time_t modified;    // source file time and size when compiled
+        off_t size;
+        image *indexed;     // next image in same hash index
+        bool incoming, outgoing;
     };
 
     object_pointer<Script> image_definitions;
     LinkedObject *image_services;
+    unsigned long image_signature;  // of definitions compiled from
+    image **image_index;
+    unsigned image_indexing;
     LinkedObject *activations;      // dynamic registry list...
+    dialplan *routes;               // inbound routing, or NULL
+
+    /**
+     * Typed config of a driver generation.  This is parsed once when the
+     * driver is created, and is never changed after, so the call path can
+     * read it through a pinned driver without key lookups.
+     */
+    typedef struct {
+        const char *voice;              // [defaults]
+        unsigned cps, burst;
+        unsigned stacking, decimals;    // [script]
+        unsigned stepping, symbols;
+        unsigned indexing, tracking;
+        unsigned compilers;
+        unsigned watching;              // msecs quiet before auto reload
+        size_t paging;
+        const char *routing;            // dialplan file, or NULL
+    } settings_t;
+
+    settings_t settings;
+
+    /**
+     * Allocate from the arena of this driver generation.  Everything
+     * allocated here is released in bulk when the generation is retired,
+     * and is counted for stats.
+     * @param size of allocation.
+     * @return allocated memory.
+     */
+    void *_alloc(size_t size);
+
+    /**
+     * Add a service image to the hash index of this driver.
+     * @param entry to index.
+     */
+    void index(image *entry);
+
+    /**
+     * Find a service image by name through the hash index.
+     * @param name of service script.
+     * @return image or NULL if not found.
+     */
+    image *find(const char *name);
+
+    /**
+     * Get the number of this driver generation.  Generations are numbered
+     * in the order they are created.
+     * @return generation number.
+     */
+    inline unsigned long getSerial(void) const
+        {return serial;}
+
+    /**
+     * Get the number of the oldest driver generation that is not yet
+     * reclaimed.  A reader pinned to an older generation no longer
+     * exists, so anything it may have held can be reused.
+     * @return oldest live generation number.
+     */
+    static unsigned long oldest(void);
 
     /**
      * Construct driver instance singleton.
@@ -185,7 +259,6 @@ protected:
     virtual ~Driver();
 
     static LinkedObject *registrations;
-    static condlock_t locking;
     static Driver *active;
     static caddr_t timeslots;
     static caddr_t boards;
@@ -245,10 +318,19 @@ public:
 
     /**
      * Get the current active driver instance and active configuration.
+     * The driver is pinned without taking a shared lock, and must be
+     * released.
      * @return driver instance that is active.
      */
     static Driver *get(void);
 
+    /**
+     * Reclaim prior driver generations once no reader still has them
+     * pinned.  This is called from the background thread.
+     * @return true if no prior generation is left waiting.
+     */
+    static bool reclaim(void);
+
     /**
      * Release an older driver instance when a reload request happens.
      * @param driver instance to release.
@@ -274,6 +356,18 @@ public:
      */
     static Script *getIncoming(const char *name);
 
+    /**
+     * Route a dialed number through the dialplan of the active driver.
+     * This is used ahead of getIncoming to select the script to run.
+     * @param dialed number to route.
+     * @param name buffer to save script name into.
+     * @param size of name buffer.
+     * @param params buffer to save script symbols into, may be NULL.
+     * @param psize of params buffer.
+     * @return true if a route matched.
+     */
+    static bool route(const char *dialed, char *name, size_t size, char *params = NULL, size_t psize = 0);
+
     /**
      * Get outgoing script by name.
      * @param name of outgoing script.
@@ -293,6 +387,30 @@ public:
      */
     static void reload(void);
 
+    /**
+     * Queue a single service script to be recompiled in the background.
+     * Only the image of that service is replaced, so the rest of the
+     * active configuration and calls in progress are not disturbed.
+     * @param name of service script, without extension.
+     */
+    static void recompile(const char *name);
+
+    /**
+     * Recompile a service script and swap it into the active driver.  New
+     * calls use the new image, while calls in progress finish on the old
+     * one, which is reference counted.
+     * @param name of service script, without extension.
+     * @return true if image was replaced.
+     */
+    static bool replace(const char *name);
+
+    /**
+     * Test if a service script is part of the active driver.
+     * @param name of service script, without extension.
+     * @return true if service is active.
+     */
+    static bool isService(const char *name);
+
     /**
      * Unwind and produce compiler error messages for a compiled script image.
      * @param img to get error compile-time messages from.
@@ -352,6 +470,20 @@ public:
      */
     static void release(statmap::stat_t stat);
 
+    /**
+     * Admit a call attempt under the system wide calls per second limit
+     * set from [defaults].
+     * @return true if admitted.
+     */
+    static bool admit(void);
+
+    /**
+     * Check if a call attempt would now be admitted under the system
+     * wide limit, without taking it or counting it as throttled.
+     * @return true if an attempt would be admitted.
+     */
+    static bool ready(void);
+
     /**
      * Dispatch a dbi event through plugins.
      * @param logfile to write for generic call log data.
@@ -368,6 +500,20 @@ public:
 
     inline keydata *registry(void)
         {return regfile.begin();}
+
+    /**
+     * Get bytes allocated from the arena of this driver generation.
+     * @return bytes allocated.
+     */
+    inline size_t getMemory(void) const
+        {return memused;}
+
+    /**
+     * Get typed config of this driver generation.
+     * @return config parsed when driver was created.
+     */
+    inline const settings_t *getSettings(void) const
+        {return &settings;}
 };
 
 } // end namespace
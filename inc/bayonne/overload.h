@@ -0,0 +1,110 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * Overload protection for new calls.
+ * This watches background thread lag, driver event depth, dbi backlog, and
+ * cpu use, and derives an overload level from them.  Drivers check the
+ * level before accepting new calls so excess calls are refused early
+ * rather than letting every active call degrade together.
+ * @file bayonne/overload.h
+ */
+
+#ifndef _BAYONNE_OVERLOAD_H_
+#define _BAYONNE_OVERLOAD_H_
+
+#ifndef _UCOMMON_LINKED_H_
+#include <ucommon/linked.h>
+#endif
+
+#ifndef _UCOMMON_THREAD_H_
+#include <ucommon/thread.h>
+#endif
+
+#ifndef _UCOMMON_STRING_H_
+#include <ucommon/string.h>
+#endif
+
+#ifndef _BAYONNE_NAMESPACE_H_
+#include <bayonne/namespace.h>
+#endif
+
+#ifndef _BAYONNE_STATS_H_
+#include <bayonne/stats.h>
+#endif
+
+namespace bayonne {
+
+class __EXPORT overload
+{
+public:
+    typedef enum {NORMAL = 0, ELEVATED, HIGH, CRITICAL} level_t;
+
+    /**
+     * Report how late the background thread was for its schedule.
+     * @param msecs late, including time spent in the sweep.
+     */
+    static void lag(timeout_t msecs);
+
+    /**
+     * Adjust count of driver events waiting for or in dispatch.
+     * @param diff to adjust by.
+     */
+    static void queued(int diff);
+
+    /**
+     * Adjust count of dbi records waiting to be processed.
+     * @param diff to adjust by.
+     */
+    static void backlog(int diff);
+
+    /**
+     * Sample cpu use and update the overload level.  This is called from
+     * the background thread, and only resamples about once a second.
+     */
+    static void sample(void);
+
+    /**
+     * Set thresholds from the [overload] section of the config.
+     * @param keys of section, may be NULL for defaults.
+     */
+    static void update(keydata *keys);
+
+    /**
+     * Get current overload level.
+     * @return level.
+     */
+    static level_t level(void);
+
+    /**
+     * Admit a new call of a given priority at the current level.  Only
+     * calls whose priority is at least the current level are admitted.
+     * Shed calls are counted in the system and optional stat node.
+     * @param priority of call, 0 to 3.
+     * @param node to count shed call against.
+     * @return true if admitted.
+     */
+    static bool admit(unsigned priority, statmap *node = NULL);
+
+    /**
+     * Get seconds to suggest before a shed call is retried.
+     * @return retry delay.
+     */
+    static unsigned retry(void);
+};
+
+} // end namespace
+
+#endif
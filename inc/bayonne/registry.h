@@ -47,6 +47,10 @@
 #include <bayonne/server.h>
 #endif
 
+#ifndef _BAYONNE_OVERLOAD_H_
+#include <bayonne/overload.h>
+#endif
+
 namespace bayonne {
 
 /**
@@ -66,6 +70,8 @@ protected:
     const char *schema;
     statmap *stats;
     unsigned limit;
+    unsigned priority;
+    unsigned long keysum;       // of config keys, to diff on reload
 
 public:
     /**
@@ -73,8 +79,17 @@ public:
      * @param list we are adding registration to.
      * @param keys of /etc/bayonne.conf config entry used.
      * @param schema of registry.
+     * @param node of stats to carry over from a replaced registration.
+     */
+    Registration(LinkedObject **list, keydata *keys, const char *schema, statmap *node = NULL);
+
+    /**
+     * Compute signature of registration config keys.  This is used on
+     * reload to find registrations that are unchanged.
+     * @param keys of registration entry.
+     * @return signature of keys.
      */
-    Registration(LinkedObject **list, keydata *keys, const char *schema);
+    static unsigned long signature(keydata *keys);
 
     /**
      * Release registration instance.  May cause deregistration from an
@@ -97,6 +112,20 @@ public:
     inline const char *getId(void)
         {return id;}
 
+    /**
+     * Get signature of config keys this registration was made from.
+     * @return signature of keys.
+     */
+    inline unsigned long getSignature(void)
+        {return keysum;}
+
+    /**
+     * Get stat node of this registration.
+     * @return stat node or NULL if none.
+     */
+    inline statmap *getStats(void)
+        {return stats;}
+
     /**
      * Get time that this registration became active.
      * @return activation time of this registration object.
@@ -117,6 +146,31 @@ public:
      */
     bool attach(statmap::stat_t stat);
 
+    /**
+     * Admit a call attempt under the calls per second limit of this
+     * registration.  This is lock-free, and is checked before a timeslot
+     * is assigned.
+     * @return true if admitted.
+     */
+    inline bool admit(void)
+        {return !stats || stats->admit();}
+
+    /**
+     * Check if a call held back for this registration could now be
+     * placed.  Nothing is taken or counted, so calls waiting to be
+     * retried do not inflate the throttled, limited, or shed stats.
+     * @return true if limits and overload level allow a new call.
+     */
+    bool ready(void);
+
+    /**
+     * Check if new calls for this registration are shed by the overload
+     * controller at the priority of this registration.
+     * @return true if not shed.
+     */
+    inline bool available(void)
+        {return overload::admit(priority, stats);}
+
     /**
      * Detach a request.  Releases lock.
      */
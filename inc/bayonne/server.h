@@ -43,6 +43,10 @@
 #include <bayonne/namespace.h>
 #endif
 
+#ifndef _BAYONNE_STATS_H_
+#include <bayonne/stats.h>
+#endif
+
 namespace bayonne {
 
 /**
@@ -70,6 +74,15 @@ public:
      */
     static void startup(shell::mainproc_t proc = NULL, bool detached = false);
 
+    /**
+     * Enter restart supervision if the server is restartable.  This is
+     * called once the initial driver has compiled its scripts, so every
+     * restarted child inherits the compiled images rather than compiling
+     * them again.
+     * @return true if running as a restartable child.
+     */
+    static bool restart(void);
+
     static void parse(int argc, char **argv, const char *dname);
 
     /**
@@ -136,10 +149,13 @@ public:
     static void snapshot(int pid);
 
     /**
-     * Extract periodic stats.
-     * @param slice time of collection.
+     * Extract periodic stats.  The record is written by a background
+     * writer so the control thread is not held up.
+     * @param slice time of collection in minutes.
+     * @param format of stats file record.
+     * @return true if a period was closed.
      */
-    static bool period(long slice);
+    static bool period(long slice, statmap::format_t format = statmap::TEXT);
 
     /**
      * Load plugins into memory.
@@ -42,6 +42,10 @@
 namespace bayonne {
 
 #define	STAT_MAP	"bayonne.sta"
+#define	STAT_WINDOWS	4		// rolling window resolutions
+#define	STAT_SLOTS		16		// ring buffer slots per window
+#define	SCRIPT_MAP		"bayonne.scr"
+#define	SCRIPT_REASONS	4		// distinct end reasons kept per entry
 
 class __EXPORT statmap 
 {
@@ -50,14 +54,65 @@ public:
 
 	typedef	enum {INCOMING = 0, OUTGOING = 1} stat_t;
 
+	typedef enum {SECONDS = 0, TENSECS, MINUTES, QUARTER} window_t;
+
 	enum {UNUSED = 0, SYSTEM, BOARD, SPAN, REGISTRY} type; 
 
+	typedef enum {TEXT = 0, CSV, JSON} format_t;
+
 	struct
 	{
 		unsigned long total, period, pperiod;
 		unsigned short current, peak, min, max, pmin, pmax;
 	} stats[2];
 
+	/**
+	 * Rolling window ring buffers, one per resolution.  Each slot packs
+	 * the slot epoch (time / resolution) in the upper 32 bits and a
+	 * value in the lower 32 bits, so the call path updates a slot with a
+	 * single compare and swap, and stale slots are detected by readers.
+	 */
+	struct
+	{
+		uint64_t calls[STAT_SLOTS];		// call attempts in slot
+		uint64_t peak[STAT_SLOTS];		// peak concurrency in slot
+	} windows[STAT_WINDOWS];
+
+	/**
+	 * Call attempt admission, as a token bucket kept in generic cell rate
+	 * form.  The theoretical arrival time is advanced by compare and swap
+	 * so admission checks never take the node lock.
+	 */
+	struct
+	{
+		uint64_t arrival;					// theoretical arrival, usecs
+		unsigned long interval, tolerance;	// usecs per call, burst allowance
+		unsigned long throttled, limited;	// cps and call limit rejections
+		unsigned long shed;					// refused by overload level
+	} admission;
+
+	/**
+	 * Overload controller gauges and the thresholds they are measured
+	 * against.  This is only kept in the system node.
+	 */
+	struct
+	{
+		unsigned short level, pressure;		// overload level, percent
+		unsigned long lag, events, backlog, cpu;
+		unsigned long maxlag, maxevents, maxbacklog, maxcpu;
+	} load;
+
+	/**
+	 * Memory held by driver generations.  Each generation is an arena
+	 * that is released in bulk once it is retired and no longer pinned.
+	 * This is only kept in the system node.
+	 */
+	struct
+	{
+		unsigned long active, arena;		// bytes in active, all generations
+		unsigned long generations;			// live, including retired
+	} memory;
+
 	time_t lastcall;
 	unsigned short timeslots;
 
@@ -66,13 +121,149 @@ public:
 	void release(stat_t element);
 	unsigned active(void) const;
 
-	static void period(FILE *fp = NULL);
+	/**
+	 * Record current concurrency, and a call attempt if there was one,
+	 * in the rolling windows.  This is done without the node lock, and
+	 * is called once the lock is released.
+	 * @param attempt true to count a call attempt.
+	 */
+	void record(bool attempt);
+
+	/**
+	 * Set call attempts per second allowed for this node.
+	 * @param cps calls per second, 0 to disable.
+	 * @param burst calls allowed back to back, defaults to cps.
+	 */
+	void throttle(unsigned cps, unsigned burst = 0);
+
+	/**
+	 * Admit a call attempt under the calls per second limit.  Rejected
+	 * attempts are counted as throttled.
+	 * @return true if admitted.
+	 */
+	bool admit(void);
+
+	/**
+	 * Check if a call attempt would now be admitted, without taking it
+	 * or counting it as throttled.
+	 * @return true if an attempt would be admitted.
+	 */
+	bool ready(void) const;
+
+	/**
+	 * Get the time covered by each slot of a rolling window.
+	 * @param window to get resolution of.
+	 * @return seconds per slot.
+	 */
+	inline static time_t resolution(window_t window)
+		{return window == SECONDS ? 1 : window == TENSECS ? 10 : window == MINUTES ? 60 : 900;}
+
+	/**
+	 * Get call attempts recorded in a rolling window slot.  This is
+	 * safe to use from a mapped view of another process.
+	 * @param window resolution to examine.
+	 * @param now current time.
+	 * @param back number of slots back, 1 is last completed slot.
+	 * @return call attempts in that slot.
+	 */
+	inline unsigned long calls(window_t window, time_t now, unsigned back = 1) const
+	{
+		uint64_t epoch = (uint64_t)(now / resolution(window)) - back;
+		uint64_t value = windows[window].calls[epoch % STAT_SLOTS];
+		return (value >> 32) == (epoch & 0xffffffff) ? (unsigned long)(value & 0xffffffff) : 0;
+	}
+
+	/**
+	 * Get peak concurrency recorded in a rolling window slot.  Slots are
+	 * sampled each second, so only slots with no sample report 0.
+	 * @param window resolution to examine.
+	 * @param now current time.
+	 * @param back number of slots back, 1 is last completed slot.
+	 * @return peak concurrent calls in that slot.
+	 */
+	inline unsigned short concurrency(window_t window, time_t now, unsigned back = 1) const
+	{
+		uint64_t epoch = (uint64_t)(now / resolution(window)) - back;
+		uint64_t value = windows[window].peak[epoch % STAT_SLOTS];
+		return (value >> 32) == (epoch & 0xffffffff) ? (unsigned short)(value & 0xffff) : 0;
+	}
+
+	/**
+	 * Roll over the current period of every node.  Each node lock is
+	 * only held to swap the period counters; the records are formatted
+	 * and appended to the stats file by a background writer.
+	 * @param path of stats file, or NULL to roll over without a record.
+	 * @param started time of period being closed.
+	 * @param ended time of period being closed.
+	 * @param format of records written.
+	 */
+	static void period(const char *path, time_t started, time_t ended, format_t format = TEXT);
+
+	/**
+	 * Record current concurrency of every node in its rolling windows, so
+	 * slots where no call started or ended still show calls in progress.
+	 * This is called from the background thread, and samples at most once
+	 * a second.
+	 */
+	static void sample(void);
 	static statmap *create(unsigned count = 0);
+	static statmap *getSystem(void);
 	static statmap *getBoard(unsigned id);
 	static statmap *getSpan(unsigned id);
 	static statmap *getRegistry(const char *id, unsigned limit = 0);
 };
 
+/**
+ * Call statistics kept per script and per dialed target.  Entries are in
+ * a shared memory open addressed hash table, claimed by compare and swap
+ * on the type, and counters are updated without locks.  The table is
+ * optional and only created when [script] tracking is set.
+ */
+class __EXPORT scriptmap
+{
+public:
+	typedef enum {UNUSED = 0, CLAIMED, SCRIPT, TARGET} type_t;
+
+	volatile unsigned type;
+	char id[64];
+	unsigned long attempts, active, completed, failed;
+	unsigned long duration;				// seconds of completed calls
+
+	struct
+	{
+		volatile unsigned key;
+		char id[12];
+		unsigned long count;
+	} reasons[SCRIPT_REASONS];
+
+	/**
+	 * Record a call that has started running this script.
+	 */
+	void assign(void);
+
+	/**
+	 * Record the end of a call.
+	 * @param duration of call in seconds.
+	 * @param reason call ended.
+	 * @param scripted true if the call was assigned to run a script.
+	 */
+	void release(time_t duration, const char *reason, bool scripted);
+
+	/**
+	 * Create the shared table.
+	 * @param count of entries, 0 to disable.
+	 */
+	static void create(unsigned count);
+
+	/**
+	 * Find or claim the entry for a script or target.
+	 * @param type of entry.
+	 * @param id of script or target.
+	 * @return entry or NULL if disabled or full.
+	 */
+	static scriptmap *get(type_t type, const char *id);
+};
+
 } // end namespace
 
 #endif
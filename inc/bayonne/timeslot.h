@@ -68,7 +68,8 @@ class __EXPORT Timeslot : public LinkedObject, public Script::interp, protected
 {
 public:
     // events
-    enum {REJECT = 0, SHUTDOWN, TIMEOUT, DROP, HANGUP, RELEASE, ENABLE, DISABLE};
+    enum {REJECT = 0, SHUTDOWN, TIMEOUT, DROP, HANGUP, RELEASE, ENABLE, DISABLE,
+        RINGING, ANSWER, FAILED};
 
     typedef struct {
         enum {NONE, DIALED, LOCAL, REMOTE, DIVERT, RECALL} type;
@@ -111,6 +112,7 @@ protected:
     Registration *registry;
     Board *board;
     Span *span;
+    scriptmap *scripted, *targeted;
     Mutex mutex;
 
     /**
@@ -131,6 +133,12 @@ protected:
      */
     void scriptHandler(event_t *event);
 
+    /**
+     * Outbound dialing handler.
+     * @param event message to process.
+     */
+    void dialHandler(event_t *event);
+
     /**
      * Handle offline events.
      * @param event message to process.
@@ -172,6 +180,13 @@ protected:
     virtual void hangup(event_t *event);
 
 
+    /**
+     * Outbound call we dialed was answered.  Derived methods may save
+     * dialog state from the event before scripting starts.
+     * @param event message of original event.
+     */
+    virtual void connect(event_t *event);
+
     /**
      * Disable a timeslot (set to offline mode...).  Derived methods may
      * toggle span channel or port status, etc.
@@ -222,6 +237,20 @@ protected:
      */
     void setScripting(void);
 
+    /**
+     * Set dialing state for an outbound call.  The attached script is
+     * started when the call is answered.
+     * @param timeout to wait for answer in milliseconds.
+     */
+    void setDialing(timeout_t timeout);
+
+    /**
+     * Bind the timeslot to a new call id.  Network drivers assign a
+     * timeslot for an outbound call before the call id is known.
+     * @param cid of call session.
+     */
+    void rebind(long cid);
+
 public:
     /**
      * Assign an available timeslot by logical call id.  This is used by
@@ -337,6 +366,13 @@ public:
      * @return timeslot for this call identifier or NULL if none.
      */
     static Timeslot *get(long cid);
+
+    /**
+     * Check if any timeslot is free to assign.  This is a hint only, as
+     * another thread may assign it first.
+     * @return true if a timeslot is free.
+     */
+    static bool available(void);
 };
 
 } // end namespace
@@ -0,0 +1,423 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Call load generator for benchmarking the sip driver.  It places calls
+// at a fixed rate over loopback, holds each for a set time, and then
+// hangs up.  It also answers registration for a test registration, such
+// as "identity = sip:bench@127.0.0.1:5070", to learn the uuid to call,
+// so a server needs only that [registry] entry and a script to answer.
+
+#include "driver.h"
+#include <sys/time.h>
+#include <sys/resource.h>
+
+using namespace bayonne;
+
+#define BENCH_CALLS     4096    // most calls in progress
+
+typedef struct {
+    voip::call_t cid;           // 0 if free
+    voip::did_t did;
+    unsigned long started;      // usecs invite was sent
+    unsigned long hangup;       // usecs to hang up, 0 until answered
+} call_t;
+
+static call_t calls[BENCH_CALLS];
+static unsigned long *setup = NULL;
+static unsigned long rate = 10, hold = 1000, total = 1000, timeout = 8000;
+static unsigned limit = 1000, port = 5070;
+static const char *target = NULL;
+static const char *secret = NULL;
+static long srvpid = 0;
+static char from[128], uuid[64];
+static unsigned long sent = 0, answered = 0, failed = 0, active = 0;
+static voip::context_t ctx = NULL;
+
+static void version(void)
+{
+    printf("Bayonne Bench " VERSION "\n"
+        "Copyright (C) 2009 David Sugar, Tycho Softworks\n"
+        "License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>\n"
+        "This is free software: you are free to change and redistribute it.\n"
+        "There is NO WARRANTY, to the extent permitted by law.\n");
+    exit(0);
+}
+
+static void usage(void)
+{
+    printf("usage: baybench [options]\n"
+        "Options:\n"
+        "  --rate <cps>            Call attempts per second (10)\n"
+        "  --hold <msecs>          Time to hold each answered call (1000)\n"
+        "  --calls <count>         Total calls to place (1000)\n"
+        "  --limit <count>         Most calls in progress (1000)\n"
+        "  --timeout <msecs>       Time for a call to be answered (8000)\n"
+        "  --port <port>           Local port, registered to by server (5070)\n"
+        "  --target <uri>          Uri to call, else learned by registration\n"
+        "  --secret <text>         Secret to answer digest challenges with\n"
+        "  --pid <pid>             Server process to report cpu usage of\n"
+    );
+    exit(0);
+}
+
+static unsigned long usecs(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (unsigned long)now.tv_sec * 1000000l + now.tv_usec;
+}
+
+// cpu time of a process in usecs, from rusage for us or /proc for server
+static unsigned long cputime(long pid)
+{
+    struct rusage usage;
+    unsigned long utime = 0, stime = 0;
+    char path[64];
+    FILE *fp;
+    int count;
+
+    if(!pid) {
+        getrusage(RUSAGE_SELF, &usage);
+        return (unsigned long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000l +
+            usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    fp = fopen(path, "r");
+    if(!fp)
+        return 0;
+
+    count = fscanf(fp, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    fclose(fp);
+    if(count != 2)
+        return 0;
+
+    return (utime + stime) * (1000000l / sysconf(_SC_CLK_TCK));
+}
+
+static int compare(const void *p1, const void *p2)
+{
+    unsigned long v1 = *(const unsigned long *)p1;
+    unsigned long v2 = *(const unsigned long *)p2;
+
+    if(v1 < v2)
+        return -1;
+    return v1 > v2;
+}
+
+static call_t *find(voip::call_t cid)
+{
+    call_t *call;
+
+    if(cid < 1)
+        return NULL;
+
+    call = &calls[cid % BENCH_CALLS];
+    if(call->cid != cid)
+        return NULL;
+
+    return call;
+}
+
+static void finish(call_t *call, bool connected)
+{
+    if(!connected)
+        ++failed;
+    call->cid = 0;
+    --active;
+}
+
+static void dial(unsigned long now)
+{
+    voip::msg_t msg = NULL;
+    voip::call_t cid;
+    call_t *call;
+
+    ++sent;
+    if(!voip::make_invite_request(ctx, target, from, NULL, &msg)) {
+        ++failed;
+        return;
+    }
+
+    cid = voip::send_invite_request(ctx, msg);
+    if(cid < 1) {
+        ++failed;
+        return;
+    }
+
+    // call ids are sequential, so a slot is only still busy if a call
+    // from long ago is hung...
+    call = &calls[cid % BENCH_CALLS];
+    if(call->cid) {
+        voip::release_call(ctx, cid, 0);
+        ++failed;
+        return;
+    }
+
+    call->cid = cid;
+    call->did = 0;
+    call->started = now;
+    call->hangup = 0;
+    ++active;
+}
+
+static void expire(unsigned long now)
+{
+    call_t *call;
+    unsigned pos;
+
+    for(pos = 0; pos < BENCH_CALLS; ++pos) {
+        call = &calls[pos];
+        if(!call->cid)
+            continue;
+
+        if(call->hangup && now >= call->hangup) {
+            voip::release_call(ctx, call->cid, call->did);
+            finish(call, true);
+        }
+        else if(!call->hangup && now - call->started >= timeout * 1000l) {
+            voip::release_call(ctx, call->cid, 0);
+            finish(call, false);
+        }
+    }
+}
+
+// we are the registrar of the test registration, and call its contact
+static void registry(voip::event_t sevent)
+{
+    static char uri[160];
+    osip_contact_t *contact = NULL;
+
+    if(osip_message_get_contact(sevent->request, 0, &contact) == 0 && contact && contact->url && contact->url->username && contact->url->host && !target) {
+        String::set(uuid, sizeof(uuid), contact->url->username);
+        if(contact->url->port)
+            snprintf(uri, sizeof(uri), "sip:%s@%s:%s", uuid, contact->url->host, contact->url->port);
+        else
+            snprintf(uri, sizeof(uri), "sip:%s@%s", uuid, contact->url->host);
+        target = uri;
+        printf("calling %s\n", target);
+    }
+    voip::send_response_message(ctx, sevent->tid, SIP_OK);
+}
+
+static void dispatch(voip::event_t sevent, unsigned long now)
+{
+    call_t *call = find(sevent->cid);
+    int status = 0;
+
+    if(sevent->response)
+        status = sevent->response->status_code;
+
+    switch(sevent->type) {
+    case EXOSIP_MESSAGE_NEW:
+        if(sevent->request && MSG_IS_REGISTER(sevent->request))
+            registry(sevent);
+        else
+            voip::send_response_message(ctx, sevent->tid, SIP_OK);
+        break;
+    case EXOSIP_CALL_ANSWERED:
+        voip::send_ack_message(ctx, sevent->did);
+        if(!call || call->hangup) {
+            if(!call)
+                voip::release_call(ctx, sevent->cid, sevent->did);
+            break;
+        }
+        setup[answered++] = now - call->started;
+        call->did = sevent->did;
+        call->hangup = now + hold * 1000l;
+        break;
+    case EXOSIP_CALL_REQUESTFAILURE:
+        // a challenge is answered once with our secret...
+        if(call && secret && (status == 401 || status == 407) && !call->did) {
+            call->did = -1;
+            voip::automatic_action(ctx);
+            break;
+        }
+    case EXOSIP_CALL_NOANSWER:
+    case EXOSIP_CALL_REDIRECTED:
+    case EXOSIP_CALL_SERVERFAILURE:
+    case EXOSIP_CALL_GLOBALFAILURE:
+    case EXOSIP_CALL_CLOSED:
+    case EXOSIP_CALL_RELEASED:
+        // a call the server hung up after answer still counts as good
+        if(call)
+            finish(call, call->hangup != 0);
+        break;
+    default:
+        break;
+    }
+}
+
+PROGRAM_MAIN(argc, argv)
+{
+    voip::event_t sevent;
+    unsigned long started, elapsed, now, waiting, cpu, srv = 0;
+    const char *cp;
+    char *ep;
+
+    while(NULL != *(++argv)) {
+        if(String::equal(*argv, "--")) {
+            ++argv;
+            break;
+        }
+
+        if(String::equal(*argv, "--", 2))
+            ++*argv;
+
+        if(String::equal(*argv, "-version"))
+            version();
+
+        if(String::equal(*argv, "-?") || String::equal(*argv, "-h") || String::equal(*argv, "-help"))
+            usage();
+
+        if(**argv != '-')
+            break;
+
+        cp = *(argv + 1);
+        if(!cp) {
+            fprintf(stderr, "*** baybench: %s: value missing\n", *argv);
+            exit(-1);
+        }
+
+        if(String::equal(*argv, "-rate"))
+            rate = atol(cp);
+        else if(String::equal(*argv, "-hold"))
+            hold = atol(cp);
+        else if(String::equal(*argv, "-calls"))
+            total = atol(cp);
+        else if(String::equal(*argv, "-limit"))
+            limit = atoi(cp);
+        else if(String::equal(*argv, "-timeout"))
+            timeout = atol(cp);
+        else if(String::equal(*argv, "-port"))
+            port = atoi(cp);
+        else if(String::equal(*argv, "-target"))
+            target = cp;
+        else if(String::equal(*argv, "-secret"))
+            secret = cp;
+        else if(String::equal(*argv, "-pid"))
+            srvpid = atol(cp);
+        else {
+            fprintf(stderr, "*** baybench: %s: unknown option\n", *argv);
+            exit(-1);
+        }
+        ++argv;
+    }
+
+    if(*argv) {
+        fprintf(stderr, "*** baybench: %s: unknown argument\n", *argv);
+        exit(-1);
+    }
+
+    if(!rate || !total) {
+        fprintf(stderr, "*** baybench: rate and calls must be set\n");
+        exit(-1);
+    }
+
+    if(!limit || limit >= BENCH_CALLS)
+        limit = BENCH_CALLS - 1;
+
+    setup = new unsigned long[total];
+    snprintf(from, sizeof(from), "sip:bench@127.0.0.1:%u", port);
+
+    voip::create(&ctx, "bayonne-bench/" VERSION);
+    if(!voip::listen(ctx, IPPROTO_UDP, "127.0.0.1", port)) {
+        fprintf(stderr, "*** baybench: cannot listen on port %u\n", port);
+        exit(-1);
+    }
+
+    if(!target)
+        printf("waiting for registration on port %u\n", port);
+
+    waiting = usecs();
+    while(!target) {
+        sevent = voip::get_event(ctx, 100);
+        if(sevent) {
+            dispatch(sevent, usecs());
+            voip::release_event(sevent);
+        }
+        if(usecs() - waiting > 60000000l) {
+            fprintf(stderr, "*** baybench: no registration\n");
+            exit(1);
+        }
+    }
+
+    // we authenticate as the registration, whose uuid is the user of the
+    // target, whether learned from its registration or given to us...
+    if(secret) {
+        if(!uuid[0]) {
+            cp = strchr(target, ':');
+            String::set(uuid, sizeof(uuid), cp ? ++cp : target);
+            ep = strchr(uuid, '@');
+            if(ep)
+                *ep = 0;
+        }
+        voip::add_authentication(ctx, uuid, secret, NULL);
+    }
+
+    cpu = cputime(0);
+    if(srvpid)
+        srv = cputime(srvpid);
+    started = usecs();
+
+    // calls are placed on schedule from the start, so a slow server
+    // shows as a lower rate, not as drift...
+    while(sent < total || active) {
+        now = usecs();
+        while(sent < total && active < limit && now - started >= sent * 1000000l / rate)
+            dial(now);
+
+        expire(now);
+        sevent = voip::get_event(ctx, 1);
+        if(sevent) {
+            dispatch(sevent, usecs());
+            voip::release_event(sevent);
+        }
+    }
+
+    elapsed = usecs() - started;
+    cpu = cputime(0) - cpu;
+    if(srvpid)
+        srv = cputime(srvpid) - srv;
+
+    // let final hangups go out...
+    waiting = usecs();
+    while(usecs() - waiting < 500000l) {
+        sevent = voip::get_event(ctx, 50);
+        if(sevent) {
+            dispatch(sevent, usecs());
+            voip::release_event(sevent);
+        }
+    }
+
+    printf("calls:     %lu sent, %lu answered, %lu failed\n", sent, answered, failed);
+    printf("rate:      %.1f cps over %.3f secs\n",
+        (double)sent * 1000000.0 / (double)elapsed, (double)elapsed / 1000000.0);
+
+    if(answered) {
+        qsort(setup, answered, sizeof(unsigned long), &compare);
+        printf("setup:     p50 %.3f, p90 %.3f, p99 %.3f, max %.3f msecs\n",
+            setup[answered / 2] / 1000.0, setup[(answered * 9) / 10] / 1000.0,
+            setup[(answered * 99) / 100] / 1000.0, setup[answered - 1] / 1000.0);
+    }
+
+    printf("cpu:       %.1f usecs per call in bench\n", (double)cpu / (double)sent);
+    if(srvpid)
+        printf("server:    %.1f usecs per call in pid %ld\n", (double)srv / (double)sent, srvpid);
+
+    voip::release(ctx);
+    PROGRAM_EXIT(failed ? 2 : 0);
+}
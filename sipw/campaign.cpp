@@ -0,0 +1,616 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "driver.h"
+#include <sys/time.h>
+
+namespace bayonne {
+
+#define CAMPAIGN_BACKOFF    16      // most doublings of retry backoff
+
+// campaigns are never freed, since timeslots of calls in progress refer
+// to them, and all campaign state is kept under one lock...
+static LinkedObject *campaigns = NULL;
+static Mutex private_lock;
+static campaign::limit_t global;
+
+static unsigned long msecs(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (unsigned long)now.tv_sec * 1000l + now.tv_usec / 1000l;
+}
+
+static void limits(campaign::limit_t *limit, const char *value)
+{
+    const char *cp;
+
+    memset(limit, 0, sizeof(campaign::limit_t));
+    if(!value)
+        return;
+
+    limit->cps = atoi(value);
+    cp = strchr(value, '/');
+    if(cp)
+        limit->calls = atoi(++cp);
+}
+
+// credit accrues at cps per second, up to a second of burst...
+static bool ready(campaign::limit_t *limit, unsigned long now)
+{
+    if(limit->calls && limit->active >= limit->calls)
+        return false;
+
+    if(!limit->cps)
+        return true;
+
+    limit->credit += (now - limit->stamp) * limit->cps;
+    limit->stamp = now;
+    if(limit->credit > limit->cps * 1000l)
+        limit->credit = limit->cps * 1000l;
+
+    return limit->credit >= 1000;
+}
+
+static void take(campaign::limit_t *limit)
+{
+    if(limit->cps)
+        limit->credit -= 1000;
+    ++limit->active;
+}
+
+static void done(campaign::limit_t *limit)
+{
+    if(limit->active)
+        --limit->active;
+}
+
+static class __LOCAL scheduler : public JoinableThread, public Conditional, protected Env
+{
+public:
+    scheduler();
+
+    volatile bool running;
+
+    void scan(void);
+    void run(void);
+} engine;
+
+scheduler::scheduler() : JoinableThread(), Conditional()
+{
+    running = false;
+}
+
+campaign::campaign(const char *id, keyfile *keys) :
+LinkedObject(&campaigns)
+{
+    keydata *base = keys->get("campaign");
+    keydata *prefs = keys->get("limits");
+    linked_pointer<keydata::keyvalue> kv;
+    const char *cp;
+    unsigned pos;
+
+    String::set(name, sizeof(name), id);
+    registry = script = list = NULL;
+    fp = NULL;
+    offset = 0;
+    eof = active = finished = changed = false;
+    retries = 2;
+    backoff = 300;
+    slot_count = 10;
+    slot_next = 0;
+    prefixes = NULL;
+    prefix_count = 0;
+    pending = NULL;
+    pending_count = pending_alloc = 0;
+    dialed = answered = failed = retried = 0;
+    limits(&limit, NULL);
+
+    if(base) {
+        registry = memcopy(base->get("registry"));
+        script = memcopy(base->get("script"));
+        list = memcopy(base->get("list"));
+        cp = base->get("cps");
+        if(cp)
+            limit.cps = atoi(cp);
+        cp = base->get("calls");
+        if(cp && atoi(cp))
+            slot_count = atoi(cp);
+        cp = base->get("retries");
+        if(cp)
+            retries = atoi(cp);
+        cp = base->get("backoff");
+        if(cp)
+            backoff = atol(cp);
+    }
+
+    limit.calls = slot_count;
+    slots = new slot_t[slot_count];
+    memset(slots, 0, sizeof(slot_t) * slot_count);
+
+    if(prefs)
+        kv = prefs->begin();
+
+    while(is(kv)) {
+        ++prefix_count;
+        kv.next();
+    }
+
+    if(prefix_count)
+        prefixes = new prefix_t[prefix_count];
+
+    // longest prefixes are kept first, so the most specific matches...
+    prefix_count = 0;
+    if(prefs)
+        kv = prefs->begin();
+    while(is(kv)) {
+        pos = prefix_count++;
+        while(pos && prefixes[pos - 1].len < strlen(kv->id)) {
+            prefixes[pos] = prefixes[pos - 1];
+            --pos;
+        }
+        String::set(prefixes[pos].prefix, sizeof(prefixes[pos].prefix), kv->id);
+        prefixes[pos].len = strlen(prefixes[pos].prefix);
+        limits(&prefixes[pos].limit, kv->value);
+        kv.next();
+    }
+}
+
+campaign::prefix_t *campaign::match(const char *number)
+{
+    unsigned pos;
+
+    for(pos = 0; pos < prefix_count; ++pos) {
+        if(eq(number, prefixes[pos].prefix, prefixes[pos].len))
+            return &prefixes[pos];
+    }
+    return NULL;
+}
+
+void campaign::defer(const char *number, unsigned attempts, time_t due)
+{
+    retry_t *heap, entry;
+    unsigned pos, parent;
+
+    if(pending_count >= pending_alloc) {
+        pending_alloc = pending_alloc ? pending_alloc * 2 : 256;
+        heap = (retry_t *)realloc(pending, sizeof(retry_t) * pending_alloc);
+        if(!heap) {
+            shell::log(shell::ERR, "campaign %s: cannot retry %s", name, number);
+            ++failed;
+            return;
+        }
+        pending = heap;
+    }
+
+    entry.due = due;
+    entry.attempts = attempts;
+    String::set(entry.number, sizeof(entry.number), number);
+
+    pos = pending_count++;
+    while(pos) {
+        parent = (pos - 1) / 2;
+        if(pending[parent].due <= due)
+            break;
+        pending[pos] = pending[parent];
+        pos = parent;
+    }
+    pending[pos] = entry;
+    changed = true;
+}
+
+// retries that are due go first, then the list is streamed from where
+// we left off...
+bool campaign::next(char *number, size_t size, unsigned *attempts, time_t now)
+{
+    char buffer[128];
+    char *cp, *tokens;
+    retry_t last;
+    unsigned pos, child;
+
+    if(pending_count && pending[0].due <= now) {
+        String::set(number, size, pending[0].number);
+        *attempts = pending[0].attempts;
+
+        last = pending[--pending_count];
+        pos = 0;
+        while((child = pos * 2 + 1) < pending_count) {
+            if(child + 1 < pending_count && pending[child + 1].due < pending[child].due)
+                ++child;
+            if(last.due <= pending[child].due)
+                break;
+            pending[pos] = pending[child];
+            pos = child;
+        }
+        pending[pos] = last;
+        return true;
+    }
+
+    while(!eof && fp) {
+        if(!fgets(buffer, sizeof(buffer), fp)) {
+            eof = true;
+            break;
+        }
+        offset = ftell(fp);
+        cp = strchr(buffer, ';');
+        if(cp)
+            *cp = 0;
+        cp = strtok_r(buffer, " \t\r\n", &tokens);
+        if(!cp)
+            continue;
+        String::set(number, size, cp);
+        *attempts = 0;
+        return true;
+    }
+    return false;
+}
+
+void campaign::schedule(time_t now, unsigned long clock)
+{
+    char number[40];
+    unsigned attempts, pos;
+    prefix_t *prefix;
+    const char *err;
+    char path[256], closed[256];
+
+    while(active) {
+        if(!ready(&global, clock) || !ready(&limit, clock))
+            return;
+
+        for(pos = 0; pos < slot_count; ++pos) {
+            if(!slots[(slot_next + pos) % slot_count].busy)
+                break;
+        }
+        if(pos >= slot_count)
+            return;
+        pos = (slot_next + pos) % slot_count;
+
+        if(!next(number, sizeof(number), &attempts, now))
+            break;
+
+        // a destination held back by its prefix waits a second, and we
+        // stop for this step so the list is not read ahead into memory...
+        prefix = match(number);
+        if(prefix && !ready(&prefix->limit, clock)) {
+            defer(number, attempts, now + 1);
+            return;
+        }
+
+        err = dialer::submit(registry, number, script, this, pos);
+        if(err) {
+            defer(number, attempts, now + 1);
+            return;
+        }
+
+        take(&global);
+        take(&limit);
+        if(prefix)
+            take(&prefix->limit);
+
+        slots[pos].busy = true;
+        slots[pos].attempts = attempts + 1;
+        slots[pos].prefix = prefix;
+        String::set(slots[pos].number, sizeof(slots[pos].number), number);
+        slot_next = pos + 1;
+        ++dialed;
+        changed = true;
+    }
+
+    if(!active || !eof || pending_count)
+        return;
+
+    for(pos = 0; pos < slot_count; ++pos) {
+        if(slots[pos].busy)
+            return;
+    }
+
+    shell::log(shell::NOTIFY, "campaign %s completed; dialed=%lu, answered=%lu, failed=%lu",
+        name, dialed, answered, failed);
+    finished = true;
+    stop();
+
+    snprintf(path, sizeof(path), "%s/%s.campaign", env("spool"), name);
+    snprintf(closed, sizeof(closed), "%s/%s.done", env("spool"), name);
+    fsys::rename(path, closed);
+}
+
+void campaign::completed(unsigned long entry, const char *reason, bool connected)
+{
+    slot_t *slot;
+    time_t due;
+    unsigned shift;
+
+    private_lock.lock();
+    if(entry >= slot_count || !slots[entry].busy) {
+        private_lock.unlock();
+        return;
+    }
+
+    slot = &slots[entry];
+    slot->busy = false;
+    done(&global);
+    done(&limit);
+    if(slot->prefix)
+        done(&slot->prefix->limit);
+
+    if(connected)
+        ++answered;
+    else if(slot->attempts <= retries && (eq(reason, "busy") || eq(reason, "noanswer") || eq(reason, "failed"))) {
+        shift = slot->attempts - 1;
+        if(shift > CAMPAIGN_BACKOFF)
+            shift = CAMPAIGN_BACKOFF;
+        time(&due);
+        defer(slot->number, slot->attempts, due + (backoff << shift));
+        ++retried;
+    }
+    else
+        ++failed;
+
+    changed = true;
+    private_lock.unlock();
+}
+
+// progress is written aside and renamed over the last checkpoint, so a
+// crash never leaves a partial one...
+void campaign::checkpoint(void)
+{
+    char path[256], temp[256];
+    unsigned pos;
+    FILE *out;
+
+    if(!changed)
+        return;
+
+    snprintf(path, sizeof(path), "%s/%s.progress", env("spool"), name);
+    snprintf(temp, sizeof(temp), "%s/.%s.progress", env("spool"), name);
+
+    out = fopen(temp, "w");
+    if(!out) {
+        shell::log(shell::ERR, "campaign %s: cannot checkpoint", name);
+        return;
+    }
+
+    fprintf(out, "offset %ld\n", offset);
+    fprintf(out, "stats %lu %lu %lu %lu\n", dialed, answered, failed, retried);
+    if(finished)
+        fprintf(out, "finished\n");
+
+    // calls in progress are dialed again if we resume from here...
+    for(pos = 0; pos < slot_count; ++pos) {
+        if(slots[pos].busy)
+            fprintf(out, "retry 0 %u %s\n", slots[pos].attempts - 1, slots[pos].number);
+    }
+
+    for(pos = 0; pos < pending_count; ++pos)
+        fprintf(out, "retry %ld %u %s\n", (long)pending[pos].due, pending[pos].attempts, pending[pos].number);
+
+    fclose(out);
+    if(!fsys::rename(temp, path))
+        changed = false;
+}
+
+void campaign::resume(const char *path)
+{
+    char buffer[128], number[40];
+    unsigned attempts;
+    long due;
+    FILE *in = fopen(path, "r");
+
+    if(!in)
+        return;
+
+    while(fgets(buffer, sizeof(buffer), in)) {
+        if(eq(buffer, "offset ", 7))
+            offset = atol(buffer + 7);
+        else if(eq(buffer, "stats ", 6))
+            sscanf(buffer + 6, "%lu %lu %lu %lu", &dialed, &answered, &failed, &retried);
+        else if(eq(buffer, "finished", 8))
+            finished = true;
+        else if(sscanf(buffer, "retry %ld %u %39s", &due, &attempts, number) == 3)
+            defer(number, attempts, (time_t)due);
+    }
+    fclose(in);
+
+    shell::log(shell::INFO, "campaign %s resumed; dialed=%lu, pending=%u",
+        name, dialed, pending_count);
+}
+
+bool campaign::start(void)
+{
+    char path[256];
+    unsigned pos;
+
+    // wait for calls from before a pause to finish first...
+    for(pos = 0; pos < slot_count; ++pos) {
+        if(slots[pos].busy)
+            return false;
+    }
+
+    if(!registry || !list) {
+        shell::log(shell::ERR, "campaign %s: registry and list required", name);
+        return false;
+    }
+
+    fp = fopen(list, "r");
+    if(!fp) {
+        shell::log(shell::ERR, "campaign %s: cannot open %s", name, list);
+        return false;
+    }
+
+    pending_count = 0;
+    offset = 0;
+    eof = finished = false;
+    snprintf(path, sizeof(path), "%s/%s.progress", env("spool"), name);
+    resume(path);
+
+    if(finished) {
+        fclose(fp);
+        fp = NULL;
+        return false;
+    }
+
+    if(offset && fseek(fp, offset, SEEK_SET))
+        eof = true;
+
+    shell::log(shell::NOTIFY, "campaign %s started from %s", name, list);
+    active = true;
+    return true;
+}
+
+void campaign::stop(void)
+{
+    active = false;
+    changed = true;
+    checkpoint();
+    if(fp)
+        fclose(fp);
+    fp = NULL;
+}
+
+// a campaign runs while its file is in the spool; removing the file
+// pauses it, and putting it back resumes from the last checkpoint...
+void scheduler::scan(void)
+{
+    char filename[256];
+    char *ext;
+    size_t len;
+    dir_t dir;
+    keyfile keys;
+    linked_pointer<campaign> cp;
+    campaign *entry;
+
+    cp = campaigns;
+    while(is(cp)) {
+        snprintf(filename, sizeof(filename), "%s/%s.campaign", env("spool"), cp->name);
+        if(cp->active && !fsys::is_file(filename)) {
+            shell::log(shell::NOTIFY, "campaign %s paused", cp->name);
+            cp->stop();
+        }
+        cp.next();
+    }
+
+    dir.open(env("spool"));
+    if(!is(dir))
+        return;
+
+    len = snprintf(filename, sizeof(filename), "%s/", env("spool"));
+    while(is(dir) && dir.read(filename + len, sizeof(filename) - len) > 0) {
+        ext = strrchr(filename + len, '.');
+        if(filename[len] == '.' || !ext || !eq(ext, ".campaign"))
+            continue;
+
+        *ext = 0;
+        entry = NULL;
+        cp = campaigns;
+        while(is(cp)) {
+            if(eq(cp->name, filename + len)) {
+                entry = *cp;
+                break;
+            }
+            cp.next();
+        }
+
+        if(entry && (entry->active || entry->finished))
+            continue;
+
+        if(!entry) {
+            *ext = '.';
+            keys.load(filename);
+            *ext = 0;
+            entry = new campaign(filename + len, &keys);
+            keys.release();
+        }
+
+        // a finished campaign is not restarted until its progress is removed
+        entry->start();
+    }
+    dir.close();
+}
+
+void scheduler::run(void)
+{
+    linked_pointer<campaign> cp;
+    time_t now, scanned = 0;
+    bool ticked;
+
+    shell::log(shell::DEBUG0, "starting campaign scheduler");
+
+    while(running) {
+        Conditional::lock();
+        Conditional::wait(Driver::getStepping());
+        Conditional::unlock();
+
+        time(&now);
+        private_lock.lock();
+        ticked = (now != scanned);
+        if(ticked) {
+            scanned = now;
+            scan();
+        }
+
+        // progress is only checkpointed once a second...
+        cp = campaigns;
+        while(is(cp)) {
+            cp->schedule(now, msecs());
+            if(ticked)
+                cp->checkpoint();
+            cp.next();
+        }
+        private_lock.unlock();
+    }
+
+    private_lock.lock();
+    cp = campaigns;
+    while(is(cp)) {
+        if(cp->active)
+            cp->stop();
+        cp.next();
+    }
+    private_lock.unlock();
+
+    shell::log(shell::DEBUG0, "stopping campaign scheduler");
+}
+
+void campaign::startup(void)
+{
+    Driver *drv = Driver::get();
+    keydata *keys = NULL;
+
+    if(drv)
+        keys = drv->keyfile::get("campaign");
+
+    limits(&global, NULL);
+    if(keys) {
+        limits(&global, keys->get("cps"));
+        if(keys->get("calls"))
+            global.calls = atoi(keys->get("calls"));
+    }
+    Driver::release(drv);
+
+    engine.running = true;
+    engine.start();
+}
+
+void campaign::shutdown(void)
+{
+    if(!engine.running)
+        return;
+
+    engine.running = false;
+    engine.join();
+}
+
+} // end namespace
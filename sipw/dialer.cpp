@@ -0,0 +1,303 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "driver.h"
+
+namespace bayonne {
+
+static dialer *engine = NULL;
+
+dialer::dialer(timeout_t ring, unsigned max) : JoinableThread(), Conditional()
+{
+    head = tail = NULL;
+    running = false;
+    ringing = ring;
+    limit = max;
+    queued = 0;
+}
+
+const char *dialer::submit(const char *id, const char *target, const char *script, campaign *owner, unsigned long entry)
+{
+    request_t *req;
+
+    if(!engine || !engine->running)
+        return "dialing not active";
+
+    if(!id || !target || strlen(id) >= sizeof(req->id) || strlen(target) >= sizeof(req->target))
+        return "missing or invalid argument";
+
+    if(script && (eq(script, "-") || !*script))
+        script = NULL;
+
+    if(script && (strchr(script, '/') || strlen(script) >= sizeof(req->script)))
+        return "invalid script";
+
+    req = (request_t *)malloc(sizeof(request_t));
+    if(!req)
+        return "no memory";
+
+    req->next = NULL;
+    String::set(req->id, sizeof(req->id), id);
+    String::set(req->target, sizeof(req->target), target);
+    req->script[0] = 0;
+    req->owner = owner;
+    req->entry = entry;
+    if(script)
+        String::set(req->script, sizeof(req->script), script);
+
+    engine->Conditional::lock();
+    if(engine->queued >= engine->limit) {
+        engine->Conditional::unlock();
+        free(req);
+        return "dial queue full";
+    }
+    ++engine->queued;
+    if(engine->tail)
+        engine->tail->next = req;
+    else
+        engine->head = req;
+    engine->tail = req;
+    engine->Conditional::signal();
+    engine->Conditional::unlock();
+    return NULL;
+}
+
+void dialer::startup(void)
+{
+    Driver *drv = Driver::get();
+    keydata *keys = NULL;
+    timeout_t ring = 45000;
+    unsigned max = 10000;
+    const char *cp;
+
+    if(drv)
+        keys = drv->keyfile::get("sip");
+
+    if(keys) {
+        cp = keys->get("ringing");
+        if(cp)
+            ring = atol(cp) * 1000l;
+        cp = keys->get("dialing");
+        if(cp)
+            max = atoi(cp);
+    }
+    Driver::release(drv);
+
+    if(!max)
+        return;
+
+    engine = new dialer(ring, max);
+    engine->running = true;
+    engine->start();
+}
+
+void dialer::shutdown(void)
+{
+    request_t *req;
+
+    if(!engine || !engine->running)
+        return;
+
+    engine->Conditional::lock();
+    engine->running = false;
+    engine->Conditional::signal();
+    engine->Conditional::unlock();
+    engine->join();
+
+    while(engine->head) {
+        req = engine->head;
+        engine->head = req->next;
+        free(req);
+    }
+    engine->tail = NULL;
+    engine->queued = 0;
+}
+
+// spool files hold one call per line as "registration target [script]",
+// and should be renamed into the spool directory once written...
+void dialer::spool(void)
+{
+    char filename[256], buffer[256];
+    char *ext, *tokens, *id, *target, *script;
+    const char *err;
+    size_t len;
+    FILE *fp;
+    dir_t dir;
+
+    dir.open(env("spool"));
+    if(!is(dir))
+        return;
+
+    len = snprintf(filename, sizeof(filename), "%s/", env("spool"));
+    while(is(dir) && dir.read(filename + len, sizeof(filename) - len) > 0) {
+        ext = strrchr(filename + len, '.');
+        if(filename[len] == '.' || !ext || !eq(ext, ".call"))
+            continue;
+
+        fp = fopen(filename, "r");
+        if(!fp)
+            continue;
+
+        while(fgets(buffer, sizeof(buffer), fp)) {
+            ext = strchr(buffer, ';');
+            if(ext)
+                *ext = 0;
+            id = strtok_r(buffer, " \t\r\n", &tokens);
+            target = strtok_r(NULL, " \t\r\n", &tokens);
+            script = strtok_r(NULL, " \t\r\n", &tokens);
+            if(!id)
+                continue;
+            err = submit(id, target, script);
+            if(err)
+                shell::log(shell::ERR, "%s: %s", filename + len, err);
+        }
+        fclose(fp);
+        fsys::remove(filename);
+    }
+    dir.close();
+}
+
+// requests held back by pacing, limits, or no free timeslot are kept in
+// order for the next pass...
+dialer::request_t *dialer::dial(request_t *list)
+{
+    request_t *kept = NULL, *last = NULL, *req;
+    registration *reg;
+    Timeslot *ts;
+    unsigned dropped = 0;
+
+    // registrations we dial from are only reused once no reader is left
+    // pinned to this generation...
+    Driver *drv = Driver::get();
+
+    while(list) {
+        req = list;
+        list = req->next;
+        req->next = NULL;
+
+        reg = driver::locate(req->id);
+        if(!reg) {
+            shell::log(shell::ERR, "%s: cannot dial, unknown registration", req->id);
+            if(req->owner)
+                req->owner->completed(req->entry, "invalid", false);
+            goto drop;
+        }
+
+        // held back requests are checked without taking or counting any
+        // admission, so waiting retries do not use up the budget of
+        // inbound calls or inflate the overload stats...
+        if(!reg->Registration::ready() || !Timeslot::available() || !Driver::ready())
+            goto keep;
+
+        if(!reg->Registration::available() || !reg->Registration::admit())
+            goto keep;
+
+        if(!reg->Registration::attach(statmap::OUTGOING))
+            goto keep;
+
+        // the system wide attempt is taken last, once a timeslot is free
+        if(!Driver::admit()) {
+            reg->Registration::release(statmap::OUTGOING);
+            goto keep;
+        }
+
+        ts = Timeslot::assign(reg, statmap::OUTGOING, thread::pending());
+        if(!ts) {
+            // no timeslots for anyone, so keep the rest as well...
+            reg->Registration::release(statmap::OUTGOING);
+            req->next = list;
+            list = NULL;
+            goto keep;
+        }
+
+        if(!static_cast<timeslot *>(ts)->outgoing(req->target, req->script[0] ? req->script : NULL, ringing, req->owner, req->entry))
+            shell::log(shell::ERR, "%s: cannot dial %s", req->id, req->target);
+
+drop:
+        free(req);
+        ++dropped;
+        continue;
+
+keep:
+        while(req) {
+            if(last)
+                last->next = req;
+            else
+                kept = req;
+            last = req;
+            req = req->next;
+        }
+    }
+
+    Driver::release(drv);
+
+    if(dropped) {
+        Conditional::lock();
+        queued -= dropped;
+        Conditional::unlock();
+    }
+    return kept;
+}
+
+void dialer::run(void)
+{
+    request_t *list, *kept = NULL, *last;
+    time_t now, scanned = 0;
+
+    shell::log(shell::DEBUG0, "starting dialer");
+
+    for(;;) {
+        // requests held back are retried each step, otherwise we only
+        // wake for new requests and to scan the spool...
+        Conditional::lock();
+        if(running && kept)
+            Conditional::wait(Driver::getStepping());
+        else if(running && !head)
+            Conditional::wait(1000);
+        if(!running) {
+            Conditional::unlock();
+            break;
+        }
+        list = head;
+        head = tail = NULL;
+        Conditional::unlock();
+
+        time(&now);
+        if(now != scanned) {
+            scanned = now;
+            spool();
+        }
+
+        kept = dial(list);
+        if(!kept)
+            continue;
+
+        // put back ahead of anything submitted meanwhile...
+        last = kept;
+        while(last->next)
+            last = last->next;
+
+        Conditional::lock();
+        last->next = head;
+        if(!head)
+            tail = last;
+        head = kept;
+        Conditional::unlock();
+    }
+
+    shell::log(shell::DEBUG0, "stopping dialer");
+}
+
+} // end namespace
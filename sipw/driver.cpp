@@ -21,10 +21,11 @@ voip::context_t driver::tcp_context = NULL;
 voip::context_t driver::udp_context = NULL;
 voip::context_t driver::tls_context = NULL;
 voip::context_t driver::out_context = NULL;
+voip::context_t *driver::shard_contexts = NULL;
+unsigned driver::shards = 0;
 int driver::family = AF_INET;
 int driver::protocol = IPPROTO_UDP;
 
-static const char *sip_realm = NULL;
 //static const char *sip_schema = "sip:";
 static unsigned expires = 300;
 static const char *iface = NULL;
@@ -32,6 +33,60 @@ static bool started = false;
 static unsigned registries = 40;
 static unsigned short port = 5060;
 
+// registrations are never freed, so the lookup tables are read without a
+// lock.  Slots are never emptied, but the slot of a registration that was
+// removed or replaced is reused, and if a table fills we fall back to
+// walking the registration list until a reload finds room again...
+static registration **by_uuid = NULL;
+static registration **by_id = NULL;
+static registration **by_rid = NULL;
+static unsigned indexing = 0;
+static bool overflow = false;
+
+// registrations that went stale on an earlier reload, and that no call,
+// other registration, or reader pinned to an older driver generation may
+// still refer to, are taken off the list and their memory is reused for
+// the next ones activated...
+static registration **spare = NULL;
+static unsigned spares = 0;
+
+static bool stale(registration *reg)
+{
+    return reg->forward() != reg;
+}
+
+static bool insert(registration **table, unsigned path, registration *reg)
+{
+    registration *prior;
+    unsigned count = 0;
+
+    while(count++ < indexing) {
+        prior = table[path];
+        if(prior == reg)
+            return true;
+        if((!prior || stale(prior)) && __sync_bool_compare_and_swap(&table[path], prior, reg))
+            return true;
+        path = (path + 1) % indexing;
+    }
+    return false;
+}
+
+static bool enlist(registration *reg)
+{
+    bool result = true;
+
+    if(!indexing)
+        return true;
+
+    if(!insert(by_uuid, NamedObject::keyindex(reg->getUUID(), indexing), reg))
+        result = false;
+    if(!insert(by_id, NamedObject::keyindex(reg->getId(), indexing), reg))
+        result = false;
+    if(reg->getRegistry() != -1 && !insert(by_rid, (unsigned)reg->getRegistry() % indexing, reg))
+        result = false;
+    return result;
+}
+
 static shell::groupopt driveropts("Driver Options");
 #ifdef  AF_INET6
 static shell::flagopt ipv6('6', "--ipv6", "default to ipv6");
@@ -44,7 +99,41 @@ static shell::numericopt slots('t', "--timeslots", "number of timeslots to alloc
 driver::driver() :
 Driver("registry")
 {
-    udp_context = tcp_context = tls_context = out_context = NULL;
+    keydata *keys = keyfile::get("sip");
+    linked_pointer<keydata::keyvalue> kv;
+
+    // voip contexts are static and already set by a prior driver on
+    // reload, so they are left alone here...
+    timing = steps = 0;
+    realm_id = NULL;
+    header_set.allow = "INVITE, ACK, CANCEL, BYE, OPTIONS, INFO, REFER, MESSAGE, SUBSCRIBE, NOTIFY, PRACK";
+    header_set.accept = "application/sdp, text/plain";
+    header_set.events = "talk, hold, refer";
+    header_set.supported = NULL;
+
+    if(!keys)
+        keys = keyfile::get("sips");
+
+    if(keys)
+        kv = keys->begin();
+
+    while(is(kv)) {
+        if(eq(kv->id, "timing"))
+            timing = atol(kv->value);
+        else if(eq(kv->id, "stepping"))
+            steps = atol(kv->value);
+        else if(eq(kv->id, "realm"))
+            realm_id = kv->value;
+        else if(eq(kv->id, "allow"))
+            header_set.allow = kv->value;
+        else if(eq(kv->id, "accept"))
+            header_set.accept = kv->value;
+        else if(eq(kv->id, "events"))
+            header_set.events = kv->value;
+        else if(eq(kv->id, "supported"))
+            header_set.supported = kv->value;
+        kv.next();
+    }
 }
 
 Driver *driver::create(void)
@@ -56,11 +145,26 @@ registration *driver::contact(const char *uuid)
 {
     assert(uuid != NULL && *uuid != 0);
 
-    linked_pointer<registration> rp = registrations;
+    linked_pointer<registration> rp;
+    registration *reg;
+    unsigned path, count = 0;
+
+    // a registration replaced on reload forwards to its replacement...
+    if(indexing) {
+        path = NamedObject::keyindex(uuid, indexing);
+        while(count++ < indexing && NULL != (reg = by_uuid[path])) {
+            if(eq(reg->getUUID(), uuid))
+                return reg->forward();
+            path = (path + 1) % indexing;
+        }
+        if(!overflow)
+            return NULL;
+    }
 
+    rp = registrations;
     while(is(rp)) {
         if(eq(rp->getUUID(), uuid))
-            return *rp;
+            return rp->forward();
         rp.next();
     }
     return NULL;
@@ -70,11 +174,25 @@ registration *driver::locate(const char *id)
 {
     assert(id != NULL && *id != 0);
 
-    linked_pointer<registration> rp = registrations;
+    linked_pointer<registration> rp;
+    registration *reg;
+    unsigned path, count = 0;
 
+    if(indexing) {
+        path = NamedObject::keyindex(id, indexing);
+        while(count++ < indexing && NULL != (reg = by_id[path])) {
+            if(eq(reg->getId(), id) && reg->forward())
+                return reg->forward();
+            path = (path + 1) % indexing;
+        }
+        if(!overflow)
+            return NULL;
+    }
+
+    rp = registrations;
     while(is(rp)) {
-        if(eq(rp->getId(), id))
-            return *rp;
+        if(eq(rp->getId(), id) && rp->forward())
+            return rp->forward();
         rp.next();
     }
     return NULL;
@@ -84,55 +202,212 @@ registration *driver::locate(int rid)
 {
     assert(rid != -1);
 
-    linked_pointer<registration> rp = registrations;
+    linked_pointer<registration> rp;
+    registration *reg;
+    unsigned path, count = 0;
+
+    if(indexing) {
+        path = (unsigned)rid % indexing;
+        while(count++ < indexing && NULL != (reg = by_rid[path])) {
+            if(reg->getRegistry() == rid)
+                return reg;
+            path = (path + 1) % indexing;
+        }
+        if(!overflow)
+            goto unknown;
+    }
 
+    rp = registrations;
     while(is(rp)) {
         if(rp->getRegistry() == rid)
             return *rp;
         rp.next();
     }
+
+unknown:
     shell::log(shell::WARN, "unknown registry id %d requested", rid);
     return NULL;
 }
 
-const char *driver::realm(void)
+const char *driver::realm(char *buf, size_t size)
 {
+    Driver *drv;
+    const char *cp = NULL;
+
     if(is(realmopt))
         return *realmopt;
 
-    if(sip_realm && *sip_realm)
-        return sip_realm;
+    // realm lives with the driver generation, so it is copied out while
+    // the generation is pinned...
+    drv = Driver::get();
+    if(drv)
+        cp = static_cast<driver *>(drv)->realm_id;
+
+    if(cp && *cp)
+        cp = String::set(buf, size, cp);
+    else
+        cp = NULL;
 
+    Driver::release(drv);
+    return cp;
+}
+
+keydata *driver::entry(const char *id)
+{
+    linked_pointer<keydata> kp = registry();
+    keydata *keys = keyfile::get("registry");
+
+    if(keys && eq(keys->get(), id))
+        return keys;
+
+    while(is(kp)) {
+        if(eq(kp->get(), id))
+            return *kp;
+        ++kp;
+    }
     return NULL;
 }
 
-void driver::update(void)
+void driver::recycle(void)
 {
-    keydata *keys = keyfile::get("sip");
-    const char *new_realm = NULL;
+    linked_pointer<registration> rp = registrations, fp;
+    unsigned long oldest = Driver::oldest();
+    registration *reg;
+    Timeslot *ts;
+    unsigned pos;
+    bool used;
+
+    while(is(rp) && spares < registries) {
+        reg = *rp;
+        rp.next();
+        if(!stale(reg))
+            continue;
+
+        // readers hold a registration only while pinned to a generation,
+        // and any that found this one are pinned to one older than ours,
+        // so it is reused once all generations before ours are gone...
+        if(!reg->getRetired()) {
+            reg->setRetired(getSerial());
+            continue;
+        }
+        if(reg->getRetired() > oldest)
+            continue;
+
+        used = false;
+        for(pos = 0; !used && NULL != (ts = Driver::get(pos)); ++pos)
+            used = (ts->getRegistry() == reg);
+        for(fp = registrations; !used && is(fp); fp.next())
+            used = fp->forwards(reg);
+        for(pos = 0; !used && pos < spares; ++pos)
+            used = spare[pos]->forwards(reg);
+        if(used)
+            continue;
+
+        // readers walking the list past us still find the next entry...
+        reg->delist(&registrations);
+        spare[spares++] = reg;
+    }
+}
 
-    if(!keys)
-        keys = keyfile::get("sips");
+void driver::reconcile(void)
+{
+    linked_pointer<registration> rp;
+    linked_pointer<keydata> kp = registry();
+    keydata *keys;
+    const char *err;
+    unsigned kept = 0, changed = 0, removed = 0, added = 0;
+
+    // only those made stale by an earlier reload can be reused...
+    recycle();
+    rp = registrations;
+
+    // registrations outlive driver generations, so they are matched to
+    // the new registry keys by id, and only changes cause sip traffic...
+    while(is(rp)) {
+        if(rp->forward() != *rp) {
+            rp.next();
+            continue;
+        }
+        keys = entry(rp->getId());
+        if(!keys) {
+            shell::log(shell::INFO, "removing %s", rp->getId());
+            rp->remove();
+            ++removed;
+        }
+        else if(Registration::signature(keys) == rp->getSignature())
+            ++kept;
+        else {
+            shell::log(shell::INFO, "replacing %s", rp->getId());
+            err = activate(keys, *rp);
+            if(err)
+                shell::log(shell::ERR, "registering %s, %s", rp->getId(), err);
+            ++changed;
+        }
+        rp.next();
+    }
 
-    linked_pointer<keydata::keyvalue> kv;
-    if(keys)
-        kv = keys->begin();
+    keys = keyfile::get("registry");
+    if(keys && !locate(keys->get())) {
+        err = activate(keys);
+        if(err)
+            shell::log(shell::ERR, "registering registry, %s", err);
+        ++added;
+    }
 
-    while(is(kv)) {
-        if(eq(kv->id, "timing"))
-            background::schedule(atol(kv->value));
-        else if(eq(kv->id, "stepping"))
-            stepping = atol(kv->value);
-        else if(eq(kv->id, "realm")) {
-            if(eq(kv->value, sip_realm))
-                new_realm = sip_realm;
-            else
-                new_realm = memcopy(kv->value);
+    while(is(kp)) {
+        if(!locate(kp->get())) {
+            err = activate(*kp);
+            if(err)
+                shell::log(shell::ERR, "registering %s, %s", kp->get(), err);
+            ++added;
         }
-        kv.next();
+        ++kp;
+    }
+
+    // stale slots were freed by this reload, so registrations that did
+    // not fit before are indexed again, and the list walk stops if all
+    // now fit...
+    if(overflow) {
+        bool full = false;
+        rp = registrations;
+        while(is(rp)) {
+            if(!stale(*rp) && !enlist(*rp))
+                full = true;
+            rp.next();
+        }
+        overflow = full;
+    }
+
+    shell::debug(2, "registrations kept=%u, changed=%u, removed=%u, added=%u",
+        kept, changed, removed, added);
+}
+
+void driver::headers(voip::msg_t msg)
+{
+    // pinning is lock free, so this is safe for the options fast path...
+    Driver *drv = Driver::get();
+
+    if(drv)
+        voip::server_headers(msg, &static_cast<driver *>(drv)->header_set);
+    else {
+        voip::server_allows(msg);
+        voip::server_accepts(msg);
     }
+    Driver::release(drv);
+}
+
+void driver::update(void)
+{
+    if(timing)
+        background::schedule(timing);
+
+    if(steps)
+        stepping = steps;
+
+    // the first driver is committed before start activates registrations
+    if(started)
+        reconcile();
 
-    sip_realm = new_realm;
     Driver::update();
 }
 
@@ -142,6 +417,7 @@ void driver::start(void)
     const char *err = NULL, *id;
     size_t stack = 0;
     unsigned priority = 1;
+    unsigned threads = 1;
 
     ts_count = 16;      // default if not modified...
     ts_alloc = sizeof(timeslot);
@@ -177,14 +453,18 @@ void driver::start(void)
             expires = atoi(kv->value);
         else if(eq(kv->id, "priority"))
             priority = atoi(kv->value);
+        else if(eq(kv->id, "threads"))
+            threads = atoi(kv->value);
+        else if(eq(kv->id, "shards"))
+            shards = atoi(kv->value);
         else if(eq(kv->id, "sessions"))
             ts_count = atoi(kv->value);
         else if(eq(kv->id, "timeslots"))
             ts_count = atoi(kv->value);
         else if(eq(kv->id, "registries"))
             registries = atoi(kv->value);
-        else if(eq(kv->id, "realm"))
-            sip_realm = memcopy(kv->value);
+        else if(eq(kv->id, "nonces"))
+            nonces::startup(atoi(kv->value));
         kv.next();
     }
 
@@ -203,6 +483,15 @@ void driver::start(void)
 #endif
 
     stats = statmap::create(registries);
+
+    // lookup tables are kept well under half full...
+    indexing = (registries * 4) | 1;
+    if(indexing < 177)
+        indexing = 177;
+    by_uuid = (registration **)memget(sizeof(registration *) * indexing);
+    by_id = (registration **)memget(sizeof(registration *) * indexing);
+    by_rid = (registration **)memget(sizeof(registration *) * indexing);
+    spare = (registration **)memget(sizeof(registration *) * registries);
     Socket::query(family);
 
     if(protocol == IPPROTO_TCP) {
@@ -220,7 +509,38 @@ void driver::start(void)
     voip::create(&tls_context, agent, family);
 #endif
 
-    if(udp_context) {
+    if(shards < 2 || protocol != IPPROTO_UDP)
+        shards = 0;
+
+    // inbound udp is spread over shards bound to our port, while requests
+    // we originate use the udp context on its own port, so their replies
+    // are not hashed to a shard that does not know the transaction...
+    for(unsigned pos = 0; pos < shards; ++pos) {
+        if(!shard_contexts)
+            shard_contexts = new voip::context_t[shards];
+        voip::create(&shard_contexts[pos], agent, family);
+        if(!voip::share(shard_contexts[pos], iface, port)) {
+            shell::log(shell::ERR, "cannot share port %u for udp", port);
+            while(pos)
+                voip::release(shard_contexts[pos--]);
+            voip::release(shard_contexts[0]);
+            delete[] shard_contexts;
+            shard_contexts = NULL;
+            shards = 0;
+            break;
+        }
+    }
+
+    if(shards)
+        shell::log(shell::NOTIFY, "listening port %u for udp, %u shards", port, shards);
+
+    if(udp_context && shards) {
+        if(!voip::listen(udp_context, IPPROTO_UDP, iface, port + 2))
+            shell::log(shell::FAIL, "cannot listen port %u for udp", port + 2);
+        else
+            shell::log(shell::NOTIFY, "listening port %u for outbound udp", port + 2);
+    }
+    else if(udp_context) {
         if(!voip::listen(udp_context, IPPROTO_UDP, iface, port))
             shell::log(shell::FAIL, "cannot listen port %u for udp", port);
         else
@@ -246,7 +566,9 @@ void driver::start(void)
     timeslots = (caddr_t)new timeslot[ts_count];
 
     Driver::start();
-    thread::activate(priority, stack);
+    thread::activate(priority, stack, threads);
+    dialer::startup();
+    campaign::startup();
 
     started = true;
 
@@ -275,6 +597,9 @@ void driver::stop(void)
 {
     linked_pointer<registration> rp = registrations;
 
+    campaign::shutdown();
+    dialer::shutdown();
+
     while(is(rp)) {
         rp->release();
         rp.next();
@@ -286,13 +611,31 @@ void driver::stop(void)
 
 const char *driver::dispatch(char **argv, int pid)
 {
+    if(eq(argv[0], "dial")) {
+        if(!argv[1] || !argv[2] || (argv[3] && argv[4]))
+            return "missing or invalid argument";
+        return dialer::submit(argv[1], argv[2], argv[3]);
+    }
+
     return Driver::dispatch(argv, pid);
 }
 
-const char *driver::activate(keydata *keys)
+const char *driver::activate(keydata *keys, registration *prior)
 {
-    void *mp = memget(sizeof(registration));
-    registration *reg = new(mp) registration(&registrations, keys, expires, port);
+    registration *reg;
+    void *mp;
+
+    if(spares)
+        mp = spare[--spares];
+    else
+        mp = memget(sizeof(registration));
+    reg = new(mp) registration(&registrations, keys, expires, port, prior);
+
+    if(!enlist(reg))
+        overflow = true;
+    if(prior)
+        prior->replace(reg);
+
     shell::log(shell::INFO, "registering with %s", reg->getServer());
 
     if(reg->getRegistry() != -1)
@@ -313,6 +656,10 @@ static void init(int argc, char **argv, bool detached, shell::mainproc_t svc = N
 
     Driver::commit(new driver());
 
+    // a restarted child only recompiles scripts changed since the fork...
+    if(server::restart())
+        Driver::reload();
+
     driver::start();
     server::dispatch();
     driver::stop();
@@ -27,10 +27,64 @@
 
 namespace bayonne {
 
+class campaign;
+
+/**
+ * Precompiled set of names from a registration list such as targets or
+ * localnames.  Entries are delimited by whitespace or ",;:".  An entry
+ * may end in "*" to match any name with that prefix, and may map to a
+ * script with "name=script".  Exact names are found by hash, so lookup
+ * does not depend on how long the list is.
+ */
+class __LOCAL matcher : protected Env
+{
+private:
+    typedef struct {
+        const char *name;
+        const char *script;
+        size_t len;
+    } entry_t;
+
+    entry_t *table;             // exact names, open addressed
+    entry_t *prefixes;          // patterns, longest first
+    unsigned size, count;
+    const char *source;         // list compiled from
+    bool folding;
+
+    unsigned hash(const char *name) const;
+    bool same(const char *name, const char *key, size_t len) const;
+
+public:
+    matcher();
+
+    /**
+     * Compile a list of names.  Compiled sets are never changed, so if
+     * the same list was compiled for a prior registration its set is
+     * shared rather than compiled again.
+     * @param list to compile, may be NULL.
+     * @param nocase if names are compared without case, as for hosts.
+     * @param prior set of a replaced registration, or NULL if none.
+     */
+    void compile(const char *list, bool nocase = false, const matcher *prior = NULL);
+
+    /**
+     * Match a name against the compiled list.
+     * @param name to match.
+     * @param script mapped by entry, or NULL if none, if not NULL.
+     * @return true if name is in list.
+     */
+    bool match(const char *name, const char **script = NULL) const;
+
+    inline bool isEmpty(void) const
+        {return !size && !count;}
+};
+
 class __LOCAL registration : public Registration
 {
 protected:
     registration *fwd;          // forwarding on replacement...
+    bool removed;               // removed from config on reload
+    unsigned long retired;      // generation first seen stale in, or 0
     unsigned expires;
     const char *userid;
     const char *secret;
@@ -39,14 +93,18 @@ protected:
     const char *uri, *contact;
     const char *targets;        // To: destinations allowed...
     const char *localnames;     // hostnames we recognize as local
+    matcher target_set, local_set;
     char uuid[38];
     voip::context_t context;
     voip::reg_t rid;
 
 public:
-    registration(LinkedObject **list, keydata *keys, unsigned expiration, unsigned port);
+    registration(LinkedObject **list, keydata *keys, unsigned expiration, unsigned port, registration *prior = NULL);
 
     void release(void);
+    void replace(registration *next);
+    void remove(void);
+    registration *forward(void);
     void cancel(void);
     void failed(void);
     void confirm(void);
@@ -64,14 +122,78 @@ public:
     inline const char *getScript(void)
         {return script;}
 
+    inline const char *getSecret(void)
+        {return secret;}
+
     inline const char *getServer(void)
         {return server;}
 
+    inline const char *getURI(void)
+        {return uri;}
+
     inline const char *getTargets(void)
         {return targets;};
 
     inline const char *getLocalnames(void)
         {return localnames;}
+
+    inline bool isTarget(const char *user, const char **scr = NULL)
+        {return target_set.match(user, scr);}
+
+    inline bool isLocal(const char *host)
+        {return local_set.match(host);}
+
+    inline bool hasTargets(void)
+        {return !target_set.isEmpty();}
+
+    inline bool forwards(registration *reg)
+        {return fwd == reg;}
+
+    inline unsigned long getRetired(void)
+        {return retired;}
+
+    inline void setRetired(unsigned long generation)
+        {retired = generation;}
+};
+
+/**
+ * Digest authentication nonces issued in challenges.  Nonces are kept in
+ * a fixed table without locks, each with its expiration and the highest
+ * nonce count used with it, so a peer may reuse a nonce for later calls
+ * without being challenged again, but may not replay a request.
+ */
+class __LOCAL nonces
+{
+public:
+    typedef enum {VALID, STALE, REPLAYED} status_t;
+
+    /**
+     * Issue a new nonce.
+     * @param buf to save nonce text in.
+     * @param size of buffer.
+     * @return nonce text.
+     */
+    static const char *create(char *buf, size_t size);
+
+    /**
+     * Check a nonce returned in an authorization and record its count.
+     * @param nonce text from authorization.
+     * @param count of nonce (nc) from authorization, required.
+     * @return status of nonce.
+     */
+    static status_t check(const char *nonce, const char *count);
+
+    /**
+     * Verify the response of a digest authorization.
+     * @param auth authorization of request.
+     * @param method of request.
+     * @param realm we challenged with.
+     * @param secret shared with peer.
+     * @return true if response is correct.
+     */
+    static bool verify(osip_authorization_t *auth, const char *method, const char *realm, const char *secret);
+
+    static void startup(unsigned lifetime);
 };
 
 class __LOCAL timeslot : public Timeslot
@@ -79,12 +201,28 @@ class __LOCAL timeslot : public Timeslot
 public:
     timeslot();
 
-    int incoming(voip::event_t sevent);
+    int incoming(voip::event_t sevent, voip::context_t source);
+
+    /**
+     * Dial an outbound call from a timeslot assigned to a registration.
+     * The @outgoing entry of the script is attached, and runs once the
+     * call is answered.  The timeslot is released if the call fails.
+     * @param target number or uri to dial.
+     * @param scrname of outgoing script, or NULL for registration default.
+     * @param ringing timeout in milliseconds to wait for answer.
+     * @param from campaign to report the result of the call to, if any.
+     * @param entry of campaign the call is for.
+     * @return true if call was sent.
+     */
+    bool outgoing(const char *target, const char *scrname, timeout_t ringing, campaign *from = NULL, unsigned long entry = 0);
 
     timeout_t getExpires(time_t now);
 
 private:
     voip::context_t ctx;
+    voip::call_t call;          // call id in the context that owns it
+    campaign *owner;            // campaign of outbound call, if any
+    unsigned long entry;
     voip::did_t did;
     voip::tid_t tid;
     Timer timer;
@@ -93,6 +231,7 @@ private:
     void arm(timeout_t timeout);
     void drop(void);
     void allocate(long cid, statmap::stat_t stat, Registration *reg);
+    void connect(event_t *event);
     void disconnect(event_t *event);
     void hangup(event_t *event);
     void release(event_t *event);
@@ -101,29 +240,48 @@ private:
 
 class __LOCAL driver : public Driver
 {
+private:
+    timeout_t timing, steps;    // parsed from [sip] when created
+    const char *realm_id;
+    voip::headers_t header_set; // for replies, prepared when created
+
+    void recycle(void);
+
 public:
     driver();
 
     Driver *create(void);
     void update(void);
+    void reconcile(void);
+    keydata *entry(const char *id);
     const char *dispatch(char **argv, int pid);
 
     static voip::context_t out_context;   // default output context
     static voip::context_t udp_context;
     static voip::context_t tcp_context;
     static voip::context_t tls_context;
+    static voip::context_t *shard_contexts;   // udp contexts sharing our port
+    static unsigned shards;
     static int family, protocol;
 
     static registration *contact(const char *uuid);
     static registration *locate(int regid);
     static registration *locate(const char *id);
-    static const char *activate(keydata *keys);
-    static const char *realm(void);
+    static const char *activate(keydata *keys, registration *prior = NULL);
+    static const char *realm(char *buf, size_t size);
+
+    /**
+     * Add the Allow, Accept, Allow-Events, and Supported headers of the
+     * current driver generation to a reply.
+     * @param msg to add headers to.
+     */
+    static void headers(voip::msg_t msg);
+
     static void start(void);
     static void stop(void);
 };
 
-class __LOCAL thread : public DetachedThread
+class __LOCAL thread : public DetachedThread, public Conditional
 {
 private:
     const char *instance;
@@ -132,16 +290,165 @@ private:
     registration *registry;
     char buffer[256];
 
+    thread **workers;           // dispatch pool of intake thread, if any
+    unsigned pool;
+    voip::event_t *queue;       // pending events of a worker thread
+    unsigned head, tail;
+
     thread();
 
     void options(void);
     void invite(void);
+    void dispatch(void);
+    void post(voip::event_t event);
     void run(void);
 
 public:
-    thread(voip::context_t source, size_t stack, const char *type);
+    thread(voip::context_t source, size_t stack, const char *type, unsigned workers = 0);
+
+    /**
+     * Get session id of a call.  Call ids are only unique within the
+     * context they belong to, so this qualifies them by context.
+     * @param source context of call.
+     * @param cid of call in context.
+     * @return session id to index timeslots by.
+     */
+    static long session(voip::context_t source, voip::call_t cid);
+
+    /**
+     * Get a temporary session id for an outbound call whose call id is
+     * not yet known.  This never matches a session of a real context.
+     * @return session id to assign a timeslot with.
+     */
+    static long pending(void);
+
+    static void activate(int priority, size_t stack, unsigned threads = 1);
+    static void shutdown(void);
+};
+
+/**
+ * Outbound call engine.  Dial requests come from the control interface
+ * or from call files in the spool directory.  They are queued, paced by
+ * the call limits and rate of the registration they dial from, and each
+ * is bound to a free timeslot when one is available.
+ */
+class __LOCAL dialer : public JoinableThread, public Conditional, protected Env
+{
+private:
+    typedef struct request {
+        struct request *next;
+        char id[64];            // registration to dial from
+        char target[128];       // number or uri
+        char script[64];        // outgoing script, or registration default
+        campaign *owner;
+        unsigned long entry;
+    } request_t;
+
+    request_t *head, *tail;
+    volatile bool running;
+    timeout_t ringing;
+    unsigned limit, queued;
+
+    dialer(timeout_t ring, unsigned max);
+
+    void run(void);
+    void spool(void);
+    request_t *dial(request_t *list);
 
-    static void activate(int priority, size_t stack);
+public:
+    /**
+     * Queue a call to dial.
+     * @param id of registration to dial from.
+     * @param target number or uri to dial.
+     * @param script to run on answer, or NULL for registration default.
+     * @param owner campaign to report result of call to, if any.
+     * @param entry of campaign the call is for.
+     * @return NULL if queued, else error message.
+     */
+    static const char *submit(const char *id, const char *target, const char *script = NULL, campaign *owner = NULL, unsigned long entry = 0);
+
+    static void startup(void);
+    static void shutdown(void);
+};
+
+/**
+ * Voice broadcast campaign.  A campaign is started by a .campaign file in
+ * the spool directory, and streams destinations from its list file into
+ * the dialer.  Calls are capped by the global campaign limits, those of
+ * the campaign, and those of destination prefixes, while the dialer also
+ * applies the limits of the registration (trunk) dialed from.  Failed
+ * calls are retried with backoff, and progress is checkpointed so the
+ * campaign resumes where it left off after a restart.
+ */
+class __LOCAL campaign : public LinkedObject, protected Env
+{
+public:
+    typedef struct {
+        unsigned cps, calls;    // limits, 0 for none
+        unsigned active;
+        unsigned long credit;   // thousandths of a call attempt
+        unsigned long stamp;    // msecs when credit was updated
+    } limit_t;
+
+private:
+    typedef struct {
+        char prefix[32];
+        size_t len;
+        limit_t limit;
+    } prefix_t;
+
+    typedef struct {
+        time_t due;
+        unsigned attempts;
+        char number[40];
+    } retry_t;
+
+    typedef struct {
+        bool busy;
+        unsigned attempts;
+        prefix_t *prefix;
+        char number[40];
+    } slot_t;
+
+    char name[64];
+    const char *registry, *script, *list;
+    FILE *fp;
+    long offset;                // of next destination in list
+    bool eof, active, finished, changed;
+    unsigned retries;
+    time_t backoff;
+    limit_t limit;
+    prefix_t *prefixes;
+    unsigned prefix_count;
+    slot_t *slots;
+    unsigned slot_count, slot_next;
+    retry_t *pending;           // heap of retries by due time
+    unsigned pending_count, pending_alloc;
+    unsigned long dialed, answered, failed, retried;
+
+    campaign(const char *id, keyfile *keys);
+
+    bool start(void);
+    void stop(void);
+    void resume(const char *path);
+    void checkpoint(void);
+    void schedule(time_t now, unsigned long msecs);
+    void defer(const char *number, unsigned attempts, time_t due);
+    bool next(char *number, size_t size, unsigned *attempts, time_t now);
+    prefix_t *match(const char *number);
+
+    friend class scheduler;
+
+public:
+    /**
+     * Report the result of a call made for this campaign.
+     * @param entry of campaign the call was for.
+     * @param reason call ended for.
+     * @param connected if call was answered.
+     */
+    void completed(unsigned long entry, const char *reason, bool connected);
+
+    static void startup(void);
     static void shutdown(void);
 };
 
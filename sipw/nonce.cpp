@@ -0,0 +1,160 @@
+// Copyright (C) 2009 David Sugar, Tycho Softworks.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "driver.h"
+
+namespace bayonne {
+
+#define NONCE_SLOTS     1024
+
+// a nonce is a random id that also selects its slot, so a newer nonce
+// simply replaces an older one, which is then seen as stale...
+typedef struct {
+    volatile uint64_t id;
+    volatile time_t expires;
+    volatile unsigned long count;   // highest nonce count used
+} nonce_t;
+
+static nonce_t table[NONCE_SLOTS];
+static volatile unsigned lifetime = 300;
+
+static const char *md5(char *out, const char *text)
+{
+    Digest digest("md5");
+    const char *cp;
+
+    digest.puts(text);
+    cp = *digest;
+    if(!cp || strlen(cp) != 32)
+        return NULL;
+
+    return String::set(out, 33, cp);
+}
+
+void nonces::startup(unsigned expires)
+{
+    if(expires)
+        lifetime = expires;
+}
+
+const char *nonces::create(char *buf, size_t size)
+{
+    uint64_t id = 0;
+    nonce_t *np;
+    time_t now;
+
+    while(!id)
+        Random::fill((unsigned char *)&id, sizeof(id));
+
+    time(&now);
+    np = &table[id % NONCE_SLOTS];
+
+    // the slot is cleared before it is reused, so a check never sees
+    // our id with the expiration or count of the prior nonce...
+    np->id = 0;
+    __sync_synchronize();
+    np->expires = now + lifetime;
+    np->count = 0;
+    __sync_synchronize();
+    np->id = id;
+
+    snprintf(buf, size, "%016llx", (unsigned long long)id);
+    return buf;
+}
+
+nonces::status_t nonces::check(const char *nonce, const char *count)
+{
+    uint64_t id;
+    unsigned long nc, last;
+    nonce_t *np;
+    time_t now, expires;
+    char *ep;
+
+    if(!nonce || strlen(nonce) != 16)
+        return STALE;
+
+    id = strtoull(nonce, &ep, 16);
+    if(!id || *ep)
+        return STALE;
+
+    time(&now);
+    np = &table[id % NONCE_SLOTS];
+    expires = np->expires;
+    __sync_synchronize();
+    if(np->id != id || now >= expires)
+        return STALE;
+
+    // without qop there is no count, and so no way to tell a replay...
+    if(!count)
+        return REPLAYED;
+
+    nc = strtoul(count, NULL, 16);
+    for(;;) {
+        last = np->count;
+        if(nc <= last)
+            return REPLAYED;
+        if(__sync_bool_compare_and_swap(&np->count, last, nc))
+            break;
+    }
+
+    if(np->id != id)
+        return STALE;
+
+    return VALID;
+}
+
+bool nonces::verify(osip_authorization_t *auth, const char *method, const char *realm, const char *secret)
+{
+    char ha1[33], ha2[33], digest[33];
+    char buffer[512];
+
+    if(!auth->username || !auth->nonce || !auth->uri || !auth->response)
+        return false;
+
+    if(!secret)
+        secret = "";
+
+    snprintf(buffer, sizeof(buffer), "%s:%s:%s", auth->username, realm, secret);
+    if(!md5(ha1, buffer))
+        return false;
+
+    if(auth->algorithm && !strcasecmp(auth->algorithm, "MD5-sess")) {
+        if(!auth->cnonce)
+            return false;
+        snprintf(buffer, sizeof(buffer), "%s:%s:%s", ha1, auth->nonce, auth->cnonce);
+        if(!md5(ha1, buffer))
+            return false;
+    }
+
+    snprintf(buffer, sizeof(buffer), "%s:%s", method, auth->uri);
+    if(!md5(ha2, buffer))
+        return false;
+
+    if(auth->message_qop) {
+        if(!auth->nonce_count || !auth->cnonce)
+            return false;
+        snprintf(buffer, sizeof(buffer), "%s:%s:%s:%s:%s:%s",
+            ha1, auth->nonce, auth->nonce_count, auth->cnonce, auth->message_qop, ha2);
+    }
+    else
+        snprintf(buffer, sizeof(buffer), "%s:%s:%s", ha1, auth->nonce, ha2);
+
+    if(!md5(digest, buffer))
+        return false;
+
+    return !strcasecmp(digest, auth->response);
+}
+
+} // end namespace
@@ -18,8 +18,167 @@
 
 namespace bayonne {
 
-registration::registration(LinkedObject **list, keydata *keys, unsigned expiration, unsigned myport) :
-Registration(list, keys, "sip:")
+#define MATCH_DELIMITERS    " \t\r\n,;:"
+
+matcher::matcher()
+{
+    table = prefixes = NULL;
+    size = count = 0;
+    source = NULL;
+    folding = false;
+}
+
+unsigned matcher::hash(const char *name) const
+{
+    unsigned long key = 2166136261ul;
+
+    while(*name) {
+        if(folding)
+            key ^= (unsigned char)tolower(*(name++));
+        else
+            key ^= (unsigned char)*(name++);
+        key *= 16777619ul;
+    }
+    return (unsigned)(key % size);
+}
+
+bool matcher::same(const char *name, const char *key, size_t len) const
+{
+    if(folding)
+        return !strncasecmp(name, key, len);
+
+    return !strncmp(name, key, len);
+}
+
+void matcher::compile(const char *list, bool nocase, const matcher *prior)
+{
+    const char *cp = list;
+    const char *eq;
+    unsigned exact = 0, patterns = 0, pos, slot;
+    size_t len;
+    char *name;
+    entry_t entry;
+
+    folding = nocase;
+    table = prefixes = NULL;
+    size = count = 0;
+    source = NULL;
+
+    if(!list)
+        return;
+
+    if(prior && prior->source && prior->folding == nocase && !strcmp(prior->source, list)) {
+        *this = *prior;
+        return;
+    }
+
+    source = list;
+
+    // count entries first so each set is sized once...
+    while(*cp) {
+        cp += strspn(cp, MATCH_DELIMITERS);
+        len = strcspn(cp, MATCH_DELIMITERS);
+        if(!len)
+            break;
+        eq = (const char *)memchr(cp, '=', len);
+        if(!eq)
+            eq = cp + len;
+        if(eq > cp && eq[-1] == '*')
+            ++patterns;
+        else if(eq > cp)
+            ++exact;
+        cp += len;
+    }
+
+    if(exact) {
+        size = exact * 2 + 1;
+        table = (entry_t *)memget(sizeof(entry_t) * size);
+    }
+
+    if(patterns)
+        prefixes = (entry_t *)memget(sizeof(entry_t) * patterns);
+
+    cp = list;
+    while(*cp) {
+        cp += strspn(cp, MATCH_DELIMITERS);
+        len = strcspn(cp, MATCH_DELIMITERS);
+        if(!len)
+            break;
+
+        name = (char *)memget(len + 1);
+        memcpy(name, cp, len);
+        cp += len;
+
+        entry.name = name;
+        entry.script = NULL;
+        name = strchr(name, '=');
+        if(name) {
+            *(name++) = 0;
+            if(*name)
+                entry.script = name;
+        }
+
+        entry.len = strlen(entry.name);
+        if(!entry.len)
+            continue;
+
+        if(entry.name[entry.len - 1] != '*') {
+            // duplicates keep the first entry...
+            slot = hash(entry.name);
+            while(table[slot].name && !(table[slot].len == entry.len && same(table[slot].name, entry.name, entry.len + 1)))
+                slot = (slot + 1) % size;
+            if(!table[slot].name)
+                table[slot] = entry;
+            continue;
+        }
+
+        // keep patterns longest first, so the most specific one matches...
+        --entry.len;
+        pos = count++;
+        while(pos && prefixes[pos - 1].len < entry.len) {
+            prefixes[pos] = prefixes[pos - 1];
+            --pos;
+        }
+        prefixes[pos] = entry;
+    }
+}
+
+bool matcher::match(const char *name, const char **script) const
+{
+    unsigned slot, pos;
+    size_t len;
+
+    if(script)
+        *script = NULL;
+
+    if(!name || !*name)
+        return false;
+
+    len = strlen(name);
+    if(size) {
+        slot = hash(name);
+        while(table[slot].name) {
+            if(table[slot].len == len && same(table[slot].name, name, len)) {
+                if(script)
+                    *script = table[slot].script;
+                return true;
+            }
+            slot = (slot + 1) % size;
+        }
+    }
+
+    for(pos = 0; pos < count; ++pos) {
+        if(prefixes[pos].len <= len && same(prefixes[pos].name, name, prefixes[pos].len)) {
+            if(script)
+                *script = prefixes[pos].script;
+            return true;
+        }
+    }
+    return false;
+}
+
+registration::registration(LinkedObject **list, keydata *keys, unsigned expiration, unsigned myport, registration *prior) :
+Registration(list, keys, "sip:", prior ? prior->getStats() : NULL)
 {
     const char *identity = keys->get("identity");
     const char *cp = keys->get("expires");
@@ -27,8 +186,17 @@ Registration(list, keys, "sip:")
     char iface[180], user[80];
     srv resolver;
 
+    // the memory may be that of a stale registration, so nothing of it
+    // may be left for a failed registration to be found by...
     context = NULL;
     fwd = NULL;
+    retired = 0;
+    removed = false;
+    rid = -1;
+    uuid[0] = 0;
+    userid = secret = server = script = NULL;
+    uri = contact = NULL;
+    targets = localnames = NULL;
 
     if(cp)
         expires = atoi(cp);
@@ -85,9 +253,12 @@ Registration(list, keys, "sip:")
     if(!localnames) {
         snprintf(buffer, sizeof(buffer), 
             "localhost, localhost.localdomain, %s", host);
-        localnames = memcopy(host);
+        localnames = memcopy(buffer);
     }
 
+    target_set.compile(targets, false, prior ? &prior->target_set : NULL);
+    local_set.compile(localnames, true, prior ? &prior->local_set : NULL);
+
     if(strchr(iface, ':'))
         snprintf(buffer, sizeof(buffer), "%s%s@[%s]:%u", schema, uuid, iface, myport);
     else
@@ -143,6 +314,36 @@ void registration::release(void)
     shell::debug(3, "registry id %d released", pid);
 }
 
+void registration::replace(registration *next)
+{
+    // unregister before forwarding, since release ignores forwarded...
+    release();
+
+    __AUTOPROTECT(this);
+    fwd = next;
+}
+
+void registration::remove(void)
+{
+    release();
+
+    __AUTOPROTECT(this);
+    removed = true;
+}
+
+registration *registration::forward(void)
+{
+    registration *reg = this;
+
+    while(reg->fwd)
+        reg = reg->fwd;
+
+    if(reg->removed)
+        return NULL;
+
+    return reg;
+}
+
 void registration::failed(void)
 {
     __AUTOPROTECT(this);
@@ -17,10 +17,10 @@
 
 namespace bayonne {
 
-static bool shutdown_flag = false;
-static unsigned shutdown_count = 0;
-static unsigned startup_count = 0;
-static unsigned active_count = 0;
+static volatile bool shutdown_flag = false;
+static volatile unsigned shutdown_count = 0;
+static volatile unsigned startup_count = 0;
+static volatile unsigned active_count = 0;
 
 static char *remove_quotes(char *c)
 {
@@ -122,14 +122,90 @@ static const char *eid(eXosip_event_type ev)
     return "unknown";
 }
 
-thread::thread(voip::context_t source, size_t stack, const char *type) :
-DetachedThread(stack)
+// reason recorded for an outbound call that was not answered...
+static const char *failure(voip::event_t sevent)
 {
-    context = source;
-    instance = type;
+	int status = 0;
+
+	if(sevent->response)
+		status = sevent->response->status_code;
+
+	switch(status) {
+	case 0:
+	case 408:
+	case 480:
+	case 487:
+		return "noanswer";
+	case 486:
+	case 600:
+		return "busy";
+	case 404:
+	case 484:
+	case 604:
+		return "invalid";
+	case 403:
+	case 603:
+		return "declined";
+	default:
+		return "failed";
+	}
 }
 
-void thread::activate(int priority, size_t stack) 
+#define THREAD_QUEUE    256
+#define THREAD_CONTEXTS 64
+
+static voip::context_t contexts[THREAD_CONTEXTS];
+static unsigned context_count = 0;
+
+thread::thread(voip::context_t source, size_t stack, const char *type, unsigned count) :
+DetachedThread(stack), Conditional()
+{
+	context = source;
+	instance = type;
+	workers = NULL;
+	pool = 0;
+	queue = NULL;
+	head = tail = 0;
+
+	// with a pool, this is the intake thread, and events are handed to
+	// workers by call id so each call is still processed in order...
+	if(count > 1) {
+		pool = count;
+		workers = new thread*[pool];
+		for(unsigned pos = 0; pos < pool; ++pos) {
+			workers[pos] = new thread(source, stack, type);
+			workers[pos]->queue = new voip::event_t[THREAD_QUEUE];
+		}
+	}
+
+	// workers share the context of their intake...
+	for(unsigned pos = 0; pos < context_count; ++pos) {
+		if(contexts[pos] == source)
+			return;
+	}
+	// the last context position is kept for calls not yet sent...
+	if(context_count < THREAD_CONTEXTS - 1)
+		contexts[context_count++] = source;
+}
+
+long thread::pending(void)
+{
+	static volatile long dialing = 0;
+
+	return (long)__sync_add_and_fetch(&dialing, 1) * THREAD_CONTEXTS + THREAD_CONTEXTS - 1;
+}
+
+long thread::session(voip::context_t source, voip::call_t cid)
+{
+	unsigned pos = 0;
+
+	while(pos < context_count && contexts[pos] != source)
+		++pos;
+
+	return (long)cid * THREAD_CONTEXTS + pos;
+}
+
+void thread::activate(int priority, size_t stack, unsigned threads)
 {
 	timeout_t timing = background::schedule();
 	unsigned count = 0;
@@ -138,24 +214,36 @@ void thread::activate(int priority, size_t stack)
 	new background(stack);
 	background::schedule(timing, 0);	
 
+	if(threads > 1)
+		shell::log(shell::INFO, "starting %u sip workers per transport", threads);
+
 	if(driver::udp_context) {
 		++count;
-        t = new thread(driver::udp_context, stack, "udp");
+        t = new thread(driver::udp_context, stack, "udp", threads);
         t->start(priority);
     }
 
 	if(driver::tcp_context) {
 		++count;
-        t = new thread(driver::tcp_context, stack, "tcp");
+        t = new thread(driver::tcp_context, stack, "tcp", threads);
         t->start(priority);
     }
 
 	if(driver::tls_context) {
 		++count;
-        t = new thread(driver::tls_context, stack, "tls");
+        t = new thread(driver::tls_context, stack, "tls", threads);
         t->start(priority);
     }
 
+	for(unsigned pos = 0; pos < driver::shards; ++pos) {
+		++count;
+		t = new thread(driver::shard_contexts[pos], stack, "udp", threads);
+		t->start(priority);
+	}
+
+	if(threads > 1)
+		count += count * threads;
+
 	while(startup_count < count)
 		Thread::sleep(50);
 }
@@ -170,116 +258,213 @@ void thread::shutdown(void)
     voip::release(driver::tcp_context);
     voip::release(driver::udp_context);
     voip::release(driver::tls_context);
+	for(unsigned pos = 0; pos < driver::shards; ++pos)
+		voip::release(driver::shard_contexts[pos]);
 	while(shutdown_count < startup_count)
 		Thread::sleep(50);
 }
 
+void thread::post(voip::event_t event)
+{
+	Conditional::lock();
+	while((tail + 1) % THREAD_QUEUE == head)
+		Conditional::wait();
+	queue[tail] = event;
+	tail = (tail + 1) % THREAD_QUEUE;
+	Conditional::broadcast();
+	Conditional::unlock();
+}
+
 void thread::run(void)
 {
-	registration *reg;
-	Timeslot *ts;
-	Timeslot::event_t event;
-    int error;
+	unsigned path;
 
-	++startup_count;
+	__sync_fetch_and_add(&startup_count, 1);
 	shell::debug(1, "starting thread %s", instance);
 
-	for(;;) {
-		error = SIP_BAD_REQUEST;
+	for(unsigned pos = 0; pos < pool; ++pos)
+		workers[pos]->start();
 
-		if(!shutdown_flag)
+	for(;;) {
+		// workers drain what was queued until the intake posts a stop...
+		if(queue) {
+			Conditional::lock();
+			while(head == tail)
+				Conditional::wait();
+			sevent = queue[head];
+			head = (head + 1) % THREAD_QUEUE;
+			Conditional::broadcast();
+			Conditional::unlock();
+			if(!sevent) {
+				shell::debug(1, "stopping worker %s", instance);
+				__sync_fetch_and_add(&shutdown_count, 1);
+				return;
+			}
+		}
+		else if(!shutdown_flag)
 			sevent = voip::get_event(context, background::schedule());
 
-		if(shutdown_flag) {
+		if(!queue && shutdown_flag) {
+			for(unsigned pos = 0; pos < pool; ++pos)
+				workers[pos]->post(NULL);
 			shell::debug(1, "stopping thread %s", instance);
-			++shutdown_count;
+			__sync_fetch_and_add(&shutdown_count, 1);
 			return; // exit thread...
 		}
 
 		if(!sevent)
 			continue;
 
-		++active_count;
-        shell::debug(2, "sip: event %s(%d); cid=%d, did=%d, instance=%s",
-            eid(sevent->type), sevent->type, sevent->cid, sevent->did, instance);
-
-		switch(sevent->type) {
-		case EXOSIP_REGISTRATION_FAILURE:
-			reg = driver::locate(sevent->rid);
-			if(sevent->response && sevent->response->status_code == 401) {
-				char *sip_realm = NULL;
-				osip_proxy_authenticate_t *prx_auth = (osip_proxy_authenticate_t*)osip_list_get(OSIP2_LIST_PTR sevent->response->proxy_authenticates, 0);
-				osip_www_authenticate_t *www_auth = (osip_proxy_authenticate_t*)osip_list_get(OSIP2_LIST_PTR sevent->response->www_authenticates,0);
-				if(prx_auth)
-					sip_realm = osip_proxy_authenticate_get_realm(prx_auth);
-				else if(www_auth)
-					sip_realm = osip_www_authenticate_get_realm(www_auth);
-				sip_realm = String::unquote(sip_realm, "\"\"");
-				if(reg)
-					reg->authenticate(sip_realm);
-			}
-			else if(reg)
-				reg->failed();
-			break;
-#ifndef  EXOSIP_API4
-		case EXOSIP_REGISTRATION_TERMINATED:
-			reg = driver::locate(sevent->rid);
+		// stateless options pings are answered by the intake itself,
+		// without queueing to workers or counting as load...
+		if(!queue && sevent->type == EXOSIP_MESSAGE_NEW && sevent->request && MSG_IS_OPTIONS(sevent->request)) {
+			options();
+			voip::release_event(sevent);
+			continue;
+		}
+
+		if(!queue) {
+			__sync_fetch_and_add(&active_count, 1);
+			overload::queued(1);
+		}
+
+		if(!pool) {
+			dispatch();
+			continue;
+		}
+
+		// transactions outside a call are kept in order by registry or tid
+		if(sevent->cid > 0)
+			path = sevent->cid;
+		else if(sevent->rid > 0)
+			path = sevent->rid;
+		else
+			path = sevent->tid;
+		workers[path % pool]->post(sevent);
+	}
+}
+
+void thread::dispatch(void)
+{
+	registration *reg;
+	Timeslot *ts;
+	Timeslot::event_t event;
+    int error = SIP_BAD_REQUEST;
+
+    shell::debug(2, "sip: event %s(%d); cid=%d, did=%d, instance=%s",
+        eid(sevent->type), sevent->type, sevent->cid, sevent->did, instance);
+
+	// registrations found while handling the event are only reused once
+	// no reader is left pinned to this generation...
+	Driver *drv = Driver::get();
+
+	switch(sevent->type) {
+	case EXOSIP_REGISTRATION_FAILURE:
+		reg = driver::locate(sevent->rid);
+		if(sevent->response && sevent->response->status_code == 401) {
+			char *sip_realm = NULL;
+			osip_proxy_authenticate_t *prx_auth = (osip_proxy_authenticate_t*)osip_list_get(OSIP2_LIST_PTR sevent->response->proxy_authenticates, 0);
+			osip_www_authenticate_t *www_auth = (osip_proxy_authenticate_t*)osip_list_get(OSIP2_LIST_PTR sevent->response->www_authenticates,0);
+			if(prx_auth)
+				sip_realm = osip_proxy_authenticate_get_realm(prx_auth);
+			else if(www_auth)
+				sip_realm = osip_www_authenticate_get_realm(www_auth);
+			sip_realm = String::unquote(sip_realm, "\"\"");
 			if(reg)
-				reg->cancel();
-			break;
+				reg->authenticate(sip_realm);
+		}
+		else if(reg)
+			reg->failed();
+		break;
+#ifndef  EXOSIP_API4
+	case EXOSIP_REGISTRATION_TERMINATED:
+		reg = driver::locate(sevent->rid);
+		if(reg)
+			reg->cancel();
+		break;
 
-		case EXOSIP_REGISTRATION_REFRESHED:
+	case EXOSIP_REGISTRATION_REFRESHED:
 #endif
-		case EXOSIP_REGISTRATION_SUCCESS:
-			reg = driver::locate(sevent->rid);
-			if(reg)
-				reg->confirm();
-			break;
-		case EXOSIP_CALL_INVITE:
-			if(!sevent->request || sevent->cid < 1) {
-				shell::log(shell::WARN, "invalid invite received");
-				break;
-			}
-			invite();
+	case EXOSIP_REGISTRATION_SUCCESS:
+		reg = driver::locate(sevent->rid);
+		if(reg)
+			reg->confirm();
+		break;
+	case EXOSIP_CALL_INVITE:
+		if(!sevent->request || sevent->cid < 1) {
+			shell::log(shell::WARN, "invalid invite received");
 			break;
-		case EXOSIP_CALL_CLOSED:
-			ts = Timeslot::get(sevent->cid);
-			if(ts) {
-				event.id = Timeslot::DROP;
-				ts->post(&event);
-			}
-			break;
-		case EXOSIP_CALL_RELEASED:
-			ts = Timeslot::get(sevent->cid);
-			if(ts) {
-				event.id = Timeslot::RELEASE;
-				ts->post(&event);
-			}
+		}
+		invite();
+		break;
+	case EXOSIP_CALL_PROCEEDING:
+	case EXOSIP_CALL_RINGING:
+		ts = Timeslot::get(session(context, sevent->cid));
+		if(ts && sevent->type == EXOSIP_CALL_RINGING) {
+			event.id = Timeslot::RINGING;
+			ts->post(&event);
+		}
+		break;
+	case EXOSIP_CALL_ANSWERED:
+		ts = Timeslot::get(session(context, sevent->cid));
+		voip::send_ack_message(context, sevent->did, NULL);
+		if(!ts) {
+			voip::release_call(context, sevent->cid, sevent->did);
 			break;
-        case EXOSIP_MESSAGE_NEW:
-            if(sevent->request) {
-                if(MSG_IS_OPTIONS(sevent->request)) {
-                    options();
+		}
+		event.id = Timeslot::ANSWER;
+		event.dialog = sevent->did;
+		ts->post(&event);
+		if(event.id == Timeslot::REJECT)
+			voip::release_call(context, sevent->cid, sevent->did);
+		break;
+	case EXOSIP_CALL_NOANSWER:
+	case EXOSIP_CALL_REDIRECTED:
+	case EXOSIP_CALL_REQUESTFAILURE:
+	case EXOSIP_CALL_SERVERFAILURE:
+	case EXOSIP_CALL_GLOBALFAILURE:
+		ts = Timeslot::get(session(context, sevent->cid));
+		if(ts) {
+			event.id = Timeslot::FAILED;
+			event.data = (void *)failure(sevent);
+			ts->post(&event);
+		}
+		break;
+	case EXOSIP_CALL_CLOSED:
+		ts = Timeslot::get(session(context, sevent->cid));
+		if(ts) {
+			event.id = Timeslot::DROP;
+			ts->post(&event);
+		}
+		break;
+	case EXOSIP_CALL_RELEASED:
+		ts = Timeslot::get(session(context, sevent->cid));
+		if(ts) {
+			event.id = Timeslot::RELEASE;
+			ts->post(&event);
+		}
+		break;
+    case EXOSIP_MESSAGE_NEW:
+        if(sevent->request) {
+            if(MSG_IS_BYE(sevent->request)) {
+                ts = Timeslot::get(session(context, sevent->cid));
+                if(ts) {
+                    event.id = Timeslot::DROP;
+                    ts->post(&event);
                     error = SIP_OK;
                 }
-                else if(MSG_IS_BYE(sevent->request)) {
-                    ts = Timeslot::get(sevent->cid);
-                    if(ts) {
-                        event.id = Timeslot::DROP;
-                        ts->post(&event);
-                        error = SIP_OK;
-                    }
-                }
             }
-            voip::send_answer_response(context, sevent->tid, error, NULL);
-            break; 
-		default:
-			shell::log(shell::WARN, "unsupported message %d", sevent->type);
-		}
-		
-        voip::release_event(sevent);
-		--active_count;
+        }
+        voip::send_answer_response(context, sevent->tid, error, NULL);
+        break; 
+	default:
+		shell::log(shell::WARN, "unsupported message %d", sevent->type);
 	}
+
+	Driver::release(drv);
+    voip::release_event(sevent);
+	overload::queued(-1);
+	__sync_fetch_and_sub(&active_count, 1);
 }
 
 void thread::options(void)
@@ -287,8 +472,7 @@ void thread::options(void)
     voip::msg_t reply = NULL;
 
     if(voip::make_options_response(context, sevent->tid, SIP_OK, &reply)) {
-        voip::server_accepts(reply);
-        voip::server_allows(reply);
+        driver::headers(reply);
         voip::send_options_response(context, sevent->tid, SIP_OK, reply);
     }
     else
@@ -298,13 +482,14 @@ void thread::options(void)
 void thread::invite(void)
 {
 	timeslot *ts = NULL;
-	const char *realm = driver::realm();
+	char realm_buf[64];
+	const char *realm = driver::realm(realm_buf, sizeof(realm_buf));
 	int error = SIP_UNDECIPHERABLE;
 	const char *uuid;
 	osip_authorization_t *auth = NULL;
 	voip::msg_t reply = NULL;
 	char nonce[32];
-	time_t now;
+	bool stale = false;
 
 	error = SIP_UNDECIPHERABLE;
 	if(!sevent->request || !sevent->request->to || !sevent->request->from || !sevent->request->req_uri)
@@ -315,40 +500,80 @@ void thread::invite(void)
 	if(!uuid || !*uuid)
 		goto reply;
 
+	// shed excess call attempts before any lookup is done, but only take
+	// the system wide attempt once the call is authenticated...
+	error = SIP_SERVICE_UNAVAILABLE;
+	if(!Driver::ready())
+		goto reply;
+
 	registry = driver::contact(uuid);
 	error = SIP_NOT_FOUND;
 	if(!registry)
 		goto reply;
 
-	// first we allocate the timeslot stat while checking the registry limit...
-	error = SIP_TEMPORARILY_UNAVAILABLE;
-	if(!registry->Registration::attach(statmap::INCOMING))
-		goto reply;
-
-	ts = static_cast<timeslot*>(Timeslot::assign(registry, statmap::INCOMING, sevent->cid));
-	if(!ts) {
-		// release registry stat allocation if no timeslots since stat was used...
-		registry->Registration::release(statmap::INCOMING);
-		goto reply;
-	}
-
+	// authenticate before limits or timeslots are taken, so a challenge
+	// costs nothing; a peer reusing a nonce we still hold is let through
+	// without another challenge...
 	error = SIP_FORBIDDEN;
 	if(realm) {
-
-		if(!sevent->request || osip_message_get_authorization(sevent->request, 0, &auth) != 0 || !auth || !auth->username || !auth->response) 
+		if(osip_message_get_authorization(sevent->request, 0, &auth) != 0 || !auth || !auth->username || !auth->response || !auth->nonce || !auth->uri)
 			goto challenge;
 
 		remove_quotes(auth->username);
 		remove_quotes(auth->uri);
 		remove_quotes(auth->nonce);
 		remove_quotes(auth->response);
+		if(auth->cnonce)
+			remove_quotes(auth->cnonce);
+		if(auth->message_qop)
+			remove_quotes(auth->message_qop);
 
 		if(!eq(auth->username, registry->getUUID()))
 			goto reply;
 
-		// CHECK MD5 SUMS!!!
+		// without qop there is no nonce count to protect against replay
+		if(!auth->message_qop || !auth->nonce_count)
+			goto reply;
+
+		if(!nonces::verify(auth, "INVITE", realm, registry->getSecret()))
+			goto reply;
+
+		switch(nonces::check(auth->nonce, auth->nonce_count)) {
+		case nonces::STALE:
+			stale = true;
+			goto challenge;
+		case nonces::REPLAYED:
+			goto reply;
+		default:
+			break;
+		}
 	}
-	error = ts->incoming(sevent);
+
+	// shed by registration priority while the server is overloaded...
+	if(!registry->Registration::available())
+		goto overloaded;
+
+	// first we allocate the timeslot stat while checking the registry limit...
+	error = SIP_TEMPORARILY_UNAVAILABLE;
+	if(!registry->Registration::attach(statmap::INCOMING))
+		goto reply;
+
+	// attempts are taken once the limit is passed, so none are lost to a
+	// call that is turned away...
+	error = SIP_SERVICE_UNAVAILABLE;
+	if(!registry->Registration::admit() || !Driver::admit()) {
+		registry->Registration::release(statmap::INCOMING);
+		goto reply;
+	}
+
+	ts = static_cast<timeslot*>(Timeslot::assign(registry, statmap::INCOMING, session(context, sevent->cid)));
+	if(!ts) {
+		// release registry stat allocation if no timeslots since stat was used...
+		registry->Registration::release(statmap::INCOMING);
+		goto reply;
+	}
+
+	error = ts->incoming(sevent, context);
 
 reply:
 	if(error) {
@@ -357,16 +582,25 @@ reply:
 	}
 	return;
 
+overloaded:
+	shell::debug(1, "shedding invite; level=%d", overload::level());
+	snprintf(buffer, sizeof(buffer), "%u", overload::retry());
+	if(voip::make_answer_response(context, sevent->tid, SIP_SERVICE_UNAVAILABLE, &reply)) {
+		osip_message_set_header(reply, "Retry-After", buffer);
+		voip::send_answer_response(context, sevent->tid, SIP_SERVICE_UNAVAILABLE, reply);
+	}
+	else
+		voip::send_answer_response(context, sevent->tid, SIP_SERVICE_UNAVAILABLE, NULL);
+	return;
+
 challenge:
 	shell::debug(1, "challenge required");
 
-	time(&now);
-    snprintf(nonce, sizeof(nonce), "%08lx", (long)now);
 	snprintf(buffer, sizeof(buffer),
-		"Digest realm=\"%s\", nonce=\"%s\", algorithm=MD5",	realm, nonce);
+		"Digest realm=\"%s\", nonce=\"%s\", qop=\"auth\", algorithm=MD5%s",
+		realm, nonces::create(nonce, sizeof(nonce)), stale ? ", stale=TRUE" : "");
     if(voip::make_answer_response(context, sevent->tid, SIP_UNAUTHORIZED, &reply)) {
-		osip_message_set_header(reply, ALLOW, "INVITE, ACK, CANCEL, BYE, REFER, OPTIONS, NOTIFY, SUBSCRIBE, PRACK, MESSAGE, INFO");
-		osip_message_set_header(reply, ALLOW_EVENTS, "talk, hold, refer");
+		driver::headers(reply);
 		osip_message_set_header(reply, WWW_AUTHENTICATE, buffer);
         voip::send_answer_response(context, sevent->tid, SIP_UNAUTHORIZED, reply);
 	}
@@ -384,6 +618,8 @@ void background::automatic(void)
         voip::automatic_action(driver::tcp_context);
     if(driver::tls_context)
         voip::automatic_action(driver::tls_context);
+    for(unsigned pos = 0; pos < driver::shards; ++pos)
+        voip::automatic_action(driver::shard_contexts[pos]);
 }
 
 } // end namespace
@@ -22,6 +22,9 @@ timeslot::timeslot() : Timeslot()
 {
 	timer = Timer::inf;
 	ctx = NULL;
+	call = -1;
+	owner = NULL;
+	entry = 0;
 }
 
 void timeslot::disarm()
@@ -53,29 +56,33 @@ void timeslot::allocate(long crn, statmap::stat_t stat, Registration *reg)
 {
 	// make sure no call session is "active" when we allocate...
 	tid = did = -1;
+	call = -1;
+	owner = NULL;
 	ctx = ((registration *)(reg))->getContext();
 	if(!ctx)
 		ctx = driver::out_context;
 	Timeslot::allocate(crn, stat, reg);
 }
 
-int timeslot::incoming(voip::event_t sevent)
+int timeslot::incoming(voip::event_t sevent, voip::context_t source)
 {
 	Script *scr = NULL;
 	registration *reg = (registration *)registry;
 	const char *cp;
 	osip_uri_t *to = NULL, *from = NULL;
-	size_t len = 0;
 	const char *entry = "@local";
 	bool remote = false, diverted = false;
 	char uri[256];
-	const char *targets = reg->getTargets();
+	char routed[64], params[256];
+	char *name, *value, *tokens = NULL;
 	const char *scrname = reg->getScript();
-	const char *localnames = reg->getLocalnames();
 	const char *caller = NULL, *dialed = NULL;
 	osip_via_t *via = NULL;
 	int from_port = 5060, via_port = 5060, to_port = 5060;
 
+	// the call belongs to the context that received it...
+	ctx = source;
+	call = sevent->cid;
 	tid = sevent->tid;
 	did = sevent->did;
 	setMapped('i', "incoming");
@@ -113,29 +120,21 @@ int timeslot::incoming(voip::event_t sevent)
 			remote = false;
 	}
 	
-	if(remote && localnames && from && from->host && from->host[0]) {
-		cp = strstr(localnames, from->host);
-		if(cp)
-			len = strlen(from->host);
-
-		if(len && (isspace(cp[len]) || strchr(",;:", cp[len]) || !cp[len])) 
-			remote = false;
-	}
+	if(remote && from && from->host && reg->isLocal(from->host))
+		remote = false;
 
 	if(remote)
 		entry = "@remote";
 
-	if(to && targets) {
-		cp = strstr(targets, to->username);
-		len = strlen(to->username);
-
-		if(cp && len) {
-			if(isspace(cp[len]) || strchr(",;:", cp[len]) || !cp[len])	{
-				scrname = to->username;
-				goto attach;
-			}
+	// a dialplan route selects the script ahead of targets...
+	if(to && Driver::route(to->username, routed, sizeof(routed), params, sizeof(params)))
+		scrname = routed;
+	else if(to && reg->hasTargets()) {
+		if(reg->isTarget(to->username, &cp)) {
+			scrname = cp ? cp : to->username;
+			goto attach;
 		}
-	
+
 		// detect diversion even if no diversion header....
 		entry = "@divert";
 		diverted = true;
@@ -206,6 +205,20 @@ attach:
 
 	setConst("script", scrname);
 	setConst("server", reg->getServer());
+
+	// symbols from the dialplan route, as name=value...
+	if(scrname == routed)
+		name = strtok_r(params, " \t", &tokens);
+	else
+		name = NULL;
+	while(name) {
+		value = strchr(name, '=');
+		if(value) {
+			*(value++) = 0;
+			setConst(name, value);
+		}
+		name = strtok_r(NULL, " \t", &tokens);
+	}
 	
 //	if(diverted && to)
 //		identity(to->username);
@@ -228,13 +241,113 @@ attach:
 	return 0;
 }
 
+bool timeslot::outgoing(const char *target, const char *scrname, timeout_t ringing, campaign *from, unsigned long id)
+{
+	registration *reg = (registration *)registry;
+	Script *scr = NULL;
+	srv resolver;
+	voip::msg_t msg = NULL;
+	voip::context_t route_ctx;
+	voip::call_t cid;
+	char to[256], route[256], host[256];
+	event_t event;
+
+	if(!scrname || !*scrname)
+		scrname = reg->getScript();
+
+	mutex.lock();
+	owner = from;
+	entry = id;
+	mapped->type = mapped_t::DIALED;
+	String::set(mapped->source, sizeof(mapped->source), reg->getId());
+	String::set(mapped->target, sizeof(mapped->target), target);
+	String::set(mapped->script, sizeof(mapped->script), scrname);
+	setMapped('o', "outgoing");
+	reason = "invalid";
+
+	// a plain number is dialed through the server we register with,
+	// while a full uri is routed on its own...
+	if(strchr(target, '@')) {
+		if(eq(target, "sip:", 4) || eq(target, "sips:", 5))
+			String::set(to, sizeof(to), target);
+		else
+			snprintf(to, sizeof(to), "sip:%s", target);
+		route_ctx = resolver.route(route, sizeof(route), to);
+		if(!route_ctx)
+			goto failed;
+		ctx = route_ctx;
+	}
+	else {
+		if(!uri::hostid(host, sizeof(host), reg->getURI()))
+			goto failed;
+		snprintf(to, sizeof(to), "sip:%s@%s", target, host);
+		String::set(route, sizeof(route), reg->getServer());
+	}
+
+	scr = Driver::getOutgoing(scrname);
+	if(!scr) {
+		shell::log(shell::ERR, "%s: script not found", scrname);
+		goto failed;
+	}
+
+	Timeslot::initialize();
+	setConst("dialed", target);
+	setConst("script", scrname);
+	setConst("server", reg->getServer());
+
+	if(!attach(scr, "@outgoing")) {
+		scr->release();
+		shell::log(shell::ERR, "%s: cannot start @outgoing", scrname);
+		goto failed;
+	}
+	scr->release();
+
+	reason = "failed";
+	snprintf(host, sizeof(host), "<%s;lr>", route);
+	if(!voip::make_invite_request(ctx, to, reg->getURI(), NULL, &msg, host))
+		goto failed;
+
+	// the context is held until the timeslot is bound to the new call id,
+	// so events of the call cannot be dispatched before...
+	cid = voip::send_invite_request(ctx, msg, true);
+	if(cid > 0) {
+		call = cid;
+		rebind(thread::session(ctx, cid));
+	}
+	voip::unlock(ctx);
+	if(cid < 1)
+		goto failed;
+
+	shell::debug(3, "timeslot %d: dialing %s for %s", instance, to, scrname);
+	reason = NULL;
+	setDialing(ringing);
+	mutex.unlock();
+	return true;
+
+failed:
+	event.id = Timeslot::RELEASE;
+	release(&event);
+	return false;
+}
+
+void timeslot::connect(event_t *event)
+{
+	did = event->dialog;
+	Timeslot::connect(event);
+}
+
 void timeslot::drop(void)
 {
 	// if active connection, we terminate...
 	if(connected) {	
-		voip::release_call(ctx, cid, did);
+		voip::release_call(ctx, call, did);
 		connected = false;
 	}
+	// if still dialing out, we cancel...
+	else if(call != -1 && mapped->type == mapped_t::DIALED) {
+		voip::release_call(ctx, call, did);
+		call = -1;
+	}
 	// if pending transaction, we decline...
 	else if(tid != -1)
 		voip::send_response_message(ctx, tid, SIP_DECLINE, NULL);
@@ -250,6 +363,7 @@ void timeslot::disconnect(event_t *event)
 
 	connected = false;
 	tid = did = -1;			
+	call = -1;
 	disarm();
 	Timeslot::disconnect(event);
 }
@@ -269,6 +383,10 @@ void timeslot::release(event_t *event)
 	// the session timed out without further state updates, in which case
 	// we should decline.
 	drop();
+	if(owner) {
+		owner->completed(entry, reason ? reason : "release", answered);
+		owner = NULL;
+	}
 	Timeslot::release(event);
 }
 
@@ -332,13 +332,16 @@ bool voip::make_invite_request(context_t ctx, const char *to, const char *from,
     return true;
 }
 
-voip::call_t voip::send_invite_request(context_t ctx, msg_t msg)
+voip::call_t voip::send_invite_request(context_t ctx, msg_t msg, bool holding)
 {
     if(!msg)
         return -1;
 
+    // holding keeps the context locked, so no event of the new call can
+    // be dispatched until the caller has bound the call id...
     int rtn = eXosip_call_send_initial_invite(ctx, msg);
-    eXosip_unlock(ctx);
+    if(!holding)
+        eXosip_unlock(ctx);
     return rtn;
 }
 
@@ -422,6 +425,60 @@ bool voip::listen(context_t ctx, int proto, const char *addr, unsigned port, boo
     return true;
 }
 
+bool voip::share(context_t ctx, const char *addr, unsigned port)
+{
+#ifdef  SO_REUSEPORT
+    struct addrinfo hint, *list = NULL;
+    char service[16];
+    int so, opt = 1;
+
+    if(!ctx)
+        return false;
+
+#ifdef  AF_INET6
+    if(family == AF_INET6 && addr && (!strcmp(addr, "::0") || !strcmp(addr, "::*")))
+        addr = NULL;
+#endif
+    if(addr && !strcmp(addr, "*"))
+        addr = NULL;
+
+    port = port & 0xfffe;
+    snprintf(service, sizeof(service), "%u", port);
+
+    // each shard binds its own socket to the same port, and the kernel
+    // spreads peers over them...
+    memset(&hint, 0, sizeof(hint));
+    hint.ai_family = family;
+    hint.ai_socktype = SOCK_DGRAM;
+    hint.ai_flags = AI_PASSIVE;
+    if(getaddrinfo(addr, service, &hint, &list) || !list)
+        return false;
+
+    so = ::socket(list->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if(so < 0) {
+        freeaddrinfo(list);
+        return false;
+    }
+
+    if(setsockopt(so, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) ||
+      setsockopt(so, SOL_SOCKET, SO_REUSEPORT, (char *)&opt, sizeof(opt)) ||
+      bind(so, list->ai_addr, list->ai_addrlen)) {
+        freeaddrinfo(list);
+        ::close(so);
+        return false;
+    }
+    freeaddrinfo(list);
+
+    if(eXosip_set_socket(ctx, IPPROTO_UDP, so, port)) {
+        ::close(so);
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 void voip::create(context_t *ctx, const char *agent, int f)
 {
     *ctx = eXosip_malloc();
@@ -548,13 +605,14 @@ bool voip::make_invite_request(context_t ctx, const char *to, const char *from,
     return true;
 }
 
-voip::call_t voip::send_invite_request(context_t ctx, msg_t msg)
+voip::call_t voip::send_invite_request(context_t ctx, msg_t msg, bool holding)
 {
     if(!msg)
         return -1;
 
     int rtn = eXosip_call_send_initial_invite(msg);
-    eXosip_unlock();
+    if(!holding)
+        eXosip_unlock();
     return rtn;
 }
 
@@ -849,6 +907,12 @@ bool voip::listen(context_t ctx, int proto, const char *addr, unsigned port, boo
     return true;
 }
 
+bool voip::share(context_t ctx, const char *addr, unsigned port)
+{
+    // there is only one context in the older api...
+    return false;
+}
+
 void voip::create(context_t *ctx, const char *agent, int f)
 {
     if(active) {
@@ -921,6 +985,18 @@ void voip::server_supports(voip::msg_t msg, const char *txt)
     osip_message_set_supported(msg, txt);
 }
 
+void voip::server_headers(voip::msg_t msg, const headers_t *headers)
+{
+    if(headers->allow)
+        osip_message_set_header(msg, ALLOW, headers->allow);
+    if(headers->accept)
+        osip_message_set_header(msg, ACCEPT, headers->accept);
+    if(headers->events)
+        osip_message_set_header(msg, ALLOW_EVENTS, headers->events);
+    if(headers->supported)
+        osip_message_set_supported(msg, headers->supported);
+}
+
 void voip::header(voip::msg_t msg, const char *key, const char *value)
 {
     osip_message_set_header(msg, key, value);
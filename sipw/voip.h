@@ -67,6 +67,13 @@ public:
 	typedef	osip_generic_param_t		*param_t;
 	typedef	osip_proxy_authenticate_t	*proxyauth_t;
 
+	typedef struct {
+		const char *allow;
+		const char *accept;
+		const char *events;			// allow-events
+		const char *supported;
+	} headers_t;
+
 	static bool make_request_message(context_t ctx, const char *method, const char *to, const char *from, msg_t *msg, const char *route = NULL);
 	static bool make_response_message(context_t ctx, tid_t tid, int status, msg_t *msg);
 	static void send_request_message(context_t ctx, msg_t msg);
@@ -76,7 +83,7 @@ public:
 	static void send_options_response(context_t ctx, tid_t tid, int status, msg_t msg = NULL);
 
 	static bool make_invite_request(context_t ctx, const char *to, const char *from, const char *subject, msg_t *msg, const char *route = NULL);
-	static call_t send_invite_request(context_t ctx, msg_t msg);
+	static call_t send_invite_request(context_t ctx, msg_t msg, bool holding = false);
 
 	static bool make_answer_response(context_t ctx, tid_t tid, int status, msg_t *msg);
 	static void send_answer_response(context_t ctx, tid_t tid, int status, msg_t msg = NULL);
@@ -115,6 +122,7 @@ public:
 	static void option(context_t ctx, int opt, const void *value);
 
 	static bool listen(context_t ctx, int proto = IPPROTO_UDP, const char *iface = NULL, unsigned port = 5060, bool tls = false);
+	static bool share(context_t ctx, const char *iface = NULL, unsigned port = 5060);
 	static void create(context_t *ctx, const char *agent, int family = AF_INET);
 	static void release(context_t ctx);
 	static void show(msg_t msg);
@@ -126,6 +134,7 @@ public:
 	static void server_accepts(voip::msg_t msg);
 	static void server_supports(voip::msg_t msg, const char *txt);
 	static void server_requires(voip::msg_t msg, const char *txt);
+	static void server_headers(voip::msg_t msg, const headers_t *headers);
 
 	bool uri_create(char *buf, size_t size, const char *server, const char *user = NULL);
 	bool uri_dialed(char *buf, size_t size, const char *to, const char *id);
@@ -164,21 +164,25 @@ static void usage(void)
         "  abort                   Driver forced abort\n"
 		"  boards                  Dump board configuration\n"
 		"  check                   Driver deadlock check\n"
+		"  compile <service>       Recompile and replace one service script\n"
         "  concurrency <level>     Driver concurrency level\n"
+		"  dial <reg> <target>     Dial an outbound call, with optional script\n"
         "  disable <resource>      Disable a timeslot or span\n"
 		"  down                    Shut down server\n"
         "  enable <resource>       Enable a disabled timeslot or span\n"
 		"  hangup <resource>       Hangup an active timeslot or span\n"
 		"  history                 Dump recent errlog history records\n"
-		"  period <interval>       Collect periodic statistics\n"
+		"  load                    Dump overload controller state\n"
+		"  period <interval> [fmt] Collect periodic statistics (text, csv, json)\n"
 		"  pstats                  Dump periodic statistics\n"
+		"  rates [window]          Dump rolling call rates (1s, 10s, 1m, 15m)\n"
         "  release <registry>      Release registration entry\n"
 		"  reload                  Reload configuration\n"
         "  restart                 Driver daemon restart\n"
 		"  resume <board>          Resume suspended board\n"
         "  snapshot                Driver snapshot\n"
         "  spans                   Dump span configuration\n"
-        "  stats                   Dump server statistics\n"
+        "  stats [script|target]   Dump server, script, or target statistics\n"
         "  suspend <board>         Suspend an active board\n"
         "  verbose <level>         Driver loggin verbose level\n"
 	);		
@@ -207,6 +211,40 @@ static void resource(char **argv, int timeout)
 	command(argv, timeout);
 }
 
+static void service(char **argv, int timeout)
+{
+	if(!argv[1]) {
+		fprintf(stderr, "*** bayonne: %s: service missing\n", *argv);
+		exit(-1);
+	}
+	if(argv[2]) {
+		fprintf(stderr, "*** bayonne: %s: only one service\n", *argv);
+		exit(-1);
+	}
+	if(strchr(argv[1], '/')) {
+		fprintf(stderr, "*** bayonne: %s: %s: invalid service\n", *argv, argv[1]);
+		exit(-1);
+	}
+	command(argv, timeout);
+}
+
+static void dial(char **argv, int timeout)
+{
+	if(!argv[1] || !argv[2]) {
+		fprintf(stderr, "*** bayonne: %s: registry and target required\n", *argv);
+		exit(-1);
+	}
+	if(argv[3] && argv[4]) {
+		fprintf(stderr, "*** bayonne: %s: too many arguments\n", *argv);
+		exit(-1);
+	}
+	if(argv[3] && strchr(argv[3], '/')) {
+		fprintf(stderr, "*** bayonne: %s: %s: invalid script\n", *argv, argv[3]);
+		exit(-1);
+	}
+	command(argv, timeout);
+}
+
 /*
 static void registry(char **argv, int timeout)
 {
@@ -281,15 +319,67 @@ static void pstats(char **argv)
 	exit(0);
 }
 
+static void scripts(char **argv)
+{
+	unsigned type = scriptmap::SCRIPT;
+	char text[160];
+
+	if(argv[2]) {
+		fprintf(stderr, "*** bayonne: stats: too many arguments\n");
+		exit(-1);
+	}
+	if(String::equal(argv[1], "target"))
+		type = scriptmap::TARGET;
+	else if(!String::equal(argv[1], "script")) {
+		fprintf(stderr, "*** bayonne: stats: %s: unknown stats\n", argv[1]);
+		exit(-1);
+	}
+
+	mapped_view<scriptmap> scr(SCRIPT_MAP);
+	unsigned count = scr.count();
+	unsigned index = 0;
+	const scriptmap *map;
+	scriptmap buffer;
+
+	if(!count) {
+		fprintf(stderr, "*** bayonne: script stats offline\n");
+		exit(-1);
+	}
+	while(index < count) {
+		map = const_cast<const scriptmap *>(scr(index++));
+
+		if(map->type != type)
+			continue;
+
+		do {
+			memcpy(&buffer, map, sizeof(buffer));
+		} while(memcmp(&buffer, map, sizeof(buffer)));
+		map = &buffer;
+
+		snprintf(text, sizeof(text), "%-20s %09lu %05lu %09lu %09lu %ld",
+			map->id, map->attempts, map->active, map->completed, map->failed,
+			map->completed ? (long)(map->duration / map->completed) : 0l);
+
+		for(unsigned slot = 0; slot < SCRIPT_REASONS; ++slot) {
+			size_t len = strlen(text);
+			if(!map->reasons[slot].key)
+				break;
+			snprintf(text + len, sizeof(text) - len, " %s=%lu",
+				map->reasons[slot].id, map->reasons[slot].count);
+		}
+		printf("%s\n", text);
+	}
+	exit(0);
+}
+
 static void stats(char **argv)
 {
 	char text[80];
 	time_t now;
 
-	if(argv[1]) {
-		fprintf(stderr, "*** bayonne: stats: no arguments used\n");
-		exit(-1);
-	}
+	if(argv[1])
+		scripts(argv);
+
 	mapped_view<statmap> sta(STAT_MAP);
 	unsigned count = sta.count();
 	unsigned index = 0;
@@ -348,6 +438,123 @@ static void stats(char **argv)
 	exit(0);
 }
 
+static void rates(char **argv)
+{
+	static const char *names[STAT_WINDOWS] = {"1s", "10s", "1m", "15m"};
+	char text[320];		// room for a full window history
+	time_t now;
+	unsigned window = STAT_WINDOWS;
+
+	if(argv[1] && argv[2]) {
+		fprintf(stderr, "*** bayonne: rates: too many arguments\n");
+		exit(-1);
+	}
+	if(argv[1]) {
+		for(window = 0; window < STAT_WINDOWS; ++window) {
+			if(String::equal(argv[1], names[window]))
+				break;
+		}
+		if(window >= STAT_WINDOWS) {
+			fprintf(stderr, "*** bayonne: rates: %s: unknown window\n", argv[1]);
+			exit(-1);
+		}
+	}
+	mapped_view<statmap> sta(STAT_MAP);
+	unsigned count = sta.count();
+	unsigned index = 0;
+	const statmap *map;
+	statmap buffer;
+
+	if(!count) {
+		fprintf(stderr, "*** bayonne: driver offline\n");
+		exit(-1);
+	}
+	time(&now);
+	while(index < count) {
+		map = const_cast<const statmap *>(sta(index++));
+
+		if(map->type == statmap::UNUSED)
+			break;
+
+		do {
+			memcpy(&buffer, map, sizeof(buffer));
+		} while(memcmp(&buffer, map, sizeof(buffer)));
+		map = &buffer;
+
+		if(map->type == statmap::BOARD)
+			snprintf(text, sizeof(text), "board/%-6s", map->id);
+		else if(map->type == statmap::SPAN)
+			snprintf(text, sizeof(text), "span/%-7s", map->id);
+		else if(map->type == statmap::REGISTRY)
+			snprintf(text, sizeof(text), "net/%-8s", map->id);
+		else
+			snprintf(text, sizeof(text), "%-12s", "system");
+
+		// history of one window, most recent completed slot first...
+		if(window < STAT_WINDOWS) {
+			for(unsigned back = 1; back < STAT_SLOTS; ++back) {
+				size_t len = strlen(text);
+				snprintf(text + len, sizeof(text) - len, " %lu/%hu",
+					map->calls((statmap::window_t)window, now, back),
+					map->concurrency((statmap::window_t)window, now, back));
+			}
+			printf("%s\n", text);
+			continue;
+		}
+
+		for(unsigned entry = 0; entry < STAT_WINDOWS; ++entry) {
+			size_t len = strlen(text);
+			snprintf(text + len, sizeof(text) - len, " %3s %8.2f %05hu", names[entry],
+				(double)map->calls((statmap::window_t)entry, now) / (double)statmap::resolution((statmap::window_t)entry),
+				map->concurrency((statmap::window_t)entry, now));
+		}
+		// call attempts rejected for cps, call limits, and overload...
+		size_t len = strlen(text);
+		snprintf(text + len, sizeof(text) - len, " %lu/%lu/%lu",
+			map->admission.throttled, map->admission.limited, map->admission.shed);
+		printf("%s\n", text);
+	}
+	exit(0);
+}
+
+static void load(char **argv)
+{
+	static const char *levels[] = {"normal", "elevated", "high", "critical"};
+
+	if(argv[1]) {
+		fprintf(stderr, "*** bayonne: load: no arguments\n");
+		exit(-1);
+	}
+	mapped_view<statmap> sta(STAT_MAP);
+	const statmap *map;
+	statmap buffer;
+
+	if(!sta.count()) {
+		fprintf(stderr, "*** bayonne: driver offline\n");
+		exit(-1);
+	}
+
+	map = const_cast<const statmap *>(sta(0));
+	do {
+		memcpy(&buffer, map, sizeof(buffer));
+	} while(memcmp(&buffer, map, sizeof(buffer)));
+	map = &buffer;
+
+	if(map->load.level > overload::CRITICAL) {
+		fprintf(stderr, "*** bayonne: load: invalid level\n");
+		exit(-1);
+	}
+
+	printf("level    %s (%u%%)\n", levels[map->load.level], map->load.pressure);
+	printf("lag      %lu/%lu msecs\n", map->load.lag, map->load.maxlag);
+	printf("events   %lu/%lu\n", map->load.events, map->load.maxevents);
+	printf("backlog  %lu/%lu\n", map->load.backlog, map->load.maxbacklog);
+	printf("cpu      %lu/%lu%%\n", map->load.cpu, map->load.maxcpu);
+	printf("shed     %lu\n", map->admission.shed);
+	printf("memory   %lu/%lu bytes, %lu generations\n", map->memory.active, map->memory.arena, map->memory.generations);
+	exit(0);
+}
+
 static void timeslots(char **argv)
 {
 	unsigned active = 0;
@@ -411,10 +618,14 @@ static void period(char **argv)
 		fprintf(stderr, "*** bayonne: period: interval missing\n");
 		exit(-1);
 	}
-	if(argv[2]) {
+	if(argv[2] && argv[3]) {
 		fprintf(stderr, "*** bayonne: period: too many arguments\n");
 		exit(-1);
 	}
+	if(argv[2] && !String::equal(argv[2], "text") && !String::equal(argv[2], "csv") && !String::equal(argv[2], "json")) {
+		fprintf(stderr, "*** bayonne: period: %s: unknown format\n", argv[2]);
+		exit(-1);
+	}
 	command(argv, 10);
 }
 
@@ -444,6 +655,10 @@ PROGRAM_MAIN(argc, argv)
 		single(argv, 0);
 	else if(String::equal(*argv, "verbose") || String::equal(*argv, "concurrency"))
 		level(argv, 10);
+	else if(String::equal(*argv, "compile"))
+		service(argv, 10);
+	else if(String::equal(*argv, "dial"))
+		dial(argv, 10);
 	else if(String::equal(*argv, "enable") || String::equal(*argv, "disable") || String::equal(*argv, "drop") || String::equal(*argv, "hangup"))
 		resource(argv, 10);
 	else if(String::equal(*argv, "status"))
@@ -456,6 +671,10 @@ PROGRAM_MAIN(argc, argv)
 		period(argv);
 	else if(String::equal(*argv, "pstats"))
 		pstats(argv);
+	else if(String::equal(*argv, "rates"))
+		rates(argv);
+	else if(String::equal(*argv, "load"))
+		load(argv);
 	fprintf(stderr, "*** bayonne: %s: unknown command or option\n", argv[0]);
 	PROGRAM_EXIT(1);
 }
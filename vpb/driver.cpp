@@ -108,6 +108,10 @@ extern "C" int main(int argc, char **argv)
 
     Driver::commit(new driver());
 
+    // a restarted child only recompiles scripts changed since the fork...
+    if(server::restart())
+        Driver::reload();
+
     driver::start();
     server::dispatch();
     driver::stop();